@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -12,6 +12,15 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// Buffers are hashed on (dev, blockno) into NBUCKET buckets,
+// each with its own lock, so lookups of different blocks
+// rarely contend. A buffer records the tick at which it was
+// last released; a miss recycles the unused buffer with the
+// oldest timestamp. bcache.lock serializes those recycles.
+//
+// breadahead starts reading a block into the cache without
+// waiting for it; the buffer is released when the read finishes.
 
 
 #include "types.h"
@@ -23,35 +32,105 @@
 #include "fs.h"
 #include "buf.h"
 
-struct {
+#define NBUCKET 13
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;   // chain through buf.next
+  int nhit;
+  int nmiss;
+  int nrahit;         // lookups satisfied by readahead
+};
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+struct {
+  struct spinlock lock;  // serializes buffer recycling
+  struct buf buf[NBUF];
+  struct bucket bucket[NBUCKET];
+  int nra;       // readahead reads in flight
+  int nraissue;  // readahead reads started
+  int nrawaste;  // readahead buffers recycled unused
 } bcache;
 
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
 
   initlock(&bcache.lock, "bcache");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    initlock(&bk->lock, "bcache.bucket");
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  // Spread the buffers over the buckets; any bucket's
+  // unused buffers may be recycled for any block.
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+    bk = &bcache.bucket[(b - bcache.buf) % NBUCKET];
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->next = bk->head;
+    bk->head = b;
   }
 }
 
+// Look for the block in bk, which must be locked.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head; b; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  return 0;
+}
+
+// Find the unused buffer with the oldest timestamp and unlink
+// it from its bucket. Caller must hold bcache.lock and no
+// bucket lock. Locks are taken in bucket order, holding at
+// most the candidate's bucket and the one being scanned.
+static struct buf*
+bvictim(void)
+{
+  struct bucket *bk, *held;
+  struct buf *b, **pp, **bestpp;
+
+  held = 0;
+  bestpp = 0;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    acquire(&bk->lock);
+    int found = 0;
+    for(pp = &bk->head; (b = *pp) != 0; pp = &b->next){
+      if(b->refcnt == 0 && (bestpp == 0 || b->lastuse < (*bestpp)->lastuse)){
+        bestpp = pp;
+        found = 1;
+      }
+    }
+    if(found){
+      if(held)
+        release(&held->lock);
+      held = bk;
+    } else {
+      release(&bk->lock);
+    }
+  }
+  if(held == 0)
+    return 0;
+
+  b = *bestpp;
+  *bestpp = b->next;
+  if(b->ra){
+    b->ra = 0;
+    bcache.nrawaste++;
+  }
+  release(&held->lock);
+  return b;
+}
+
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
@@ -59,33 +138,134 @@ static struct buf*
 bget(uint dev, uint blockno)
 {
   struct buf *b;
+  struct bucket *bk;
 
-  acquire(&bcache.lock);
+  bk = bhash(dev, blockno);
+  acquire(&bk->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  if((b = bfind(bk, dev, blockno)) != 0){
+    b->refcnt++;
+    bk->nhit++;
+    if(b->ra){
+      b->ra = 0;
+      bk->nrahit++;
     }
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    return b;
   }
+  release(&bk->lock);
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // Not cached. Only one CPU at a time may recycle a buffer,
+  // so check again in case another one just cached the block.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) != 0){
+    b->refcnt++;
+    bk->nhit++;
+    if(b->ra){
+      b->ra = 0;
+      bk->nrahit++;
     }
+    release(&bk->lock);
+    release(&bcache.lock);
+    acquiresleep(&b->lock);
+    return b;
   }
-  panic("bget: no buffers");
+  release(&bk->lock);
+
+  // Recycle the least recently used unused buffer. Once
+  // unlinked it is invisible to lookups, and no one else can
+  // insert this block while we hold bcache.lock.
+  if((b = bvictim()) == 0)
+    panic("bget: no buffers");
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+
+  acquire(&bk->lock);
+  b->next = bk->head;
+  bk->head = b;
+  bk->nmiss++;
+  release(&bk->lock);
+  release(&bcache.lock);
+
+  acquiresleep(&b->lock);
+  return b;
+}
+
+// Drop a reference to b, whose sleeplock is not held.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk;
+
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    // no one is waiting for it.
+    b->lastuse = uptime();
+  }
+  release(&bk->lock);
+}
+
+// Called from virtio_disk_intr() when a readahead finishes.
+static void
+breaddone(struct buf *b)
+{
+  b->done = 0;
+  b->valid = 1;
+  releasesleep(&b->lock);
+  bput(b);
+  __sync_fetch_and_add(&bcache.nra, -1);
+}
+
+// Start reading the block into the cache, if it isn't there
+// already, without waiting. Gives up rather than sleep if no
+// buffer is free or RAMAX readaheads are already in flight.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct buf *b;
+  struct bucket *bk;
+
+  bk = bhash(dev, blockno);
+  acquire(&bk->lock);
+  b = bfind(bk, dev, blockno);
+  release(&bk->lock);
+  if(b != 0 || bcache.nra >= RAMAX)
+    return;
+
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  b = bfind(bk, dev, blockno);
+  release(&bk->lock);
+  if(b != 0 || bcache.nra >= RAMAX || (b = bvictim()) == 0){
+    release(&bcache.lock);
+    return;
+  }
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  b->ra = 1;
+  b->done = breaddone;
+  // b is unused and not yet visible, so this doesn't sleep;
+  // a reader that finds b will wait for breaddone.
+  acquiresleep(&b->lock);
+
+  acquire(&bk->lock);
+  b->next = bk->head;
+  bk->head = b;
+  release(&bk->lock);
+  __sync_fetch_and_add(&bcache.nra, 1);
+  bcache.nraissue++;
+  release(&bcache.lock);
+
+  virtio_disk_start(b, 0);
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -112,7 +292,7 @@ bwrite(struct buf *b)
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// An unused buffer remembers when it was last released.
 void
 brelse(struct buf *b)
 {
@@ -120,34 +300,42 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
-
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+  bput(b);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bhash(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bhash(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
+// Report buffer cache hit rate for the statistics device.
+int
+statsbcache(char *buf, int sz)
+{
+  int n, nhit, nmiss, nrahit;
+  struct bucket *bk;
 
+  nhit = nmiss = nrahit = 0;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    nhit += bk->nhit;
+    nmiss += bk->nmiss;
+    nrahit += bk->nrahit;
+  }
+  n = snprintf(buf, sz, "bcache: hit %d miss %d\n", nhit, nmiss);
+  n += snprintf(buf+n, sz-n, "readahead: issued %d hit %d wasted %d\n",
+                bcache.nraissue, nrahit, bcache.nrawaste);
+  return n;
+}
@@ -1,12 +1,14 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  void (*done)(struct buf*); // if set, called when the disk finishes; must not sleep
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
+  uint lastuse; // ticks when refcnt last dropped to 0
+  int ra;       // read ahead and not yet looked up?
+  struct buf *next; // hash bucket chain
   uchar data[BSIZE];
 };
 
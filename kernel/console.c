@@ -21,6 +21,7 @@
 #include "riscv.h"
 #include "defs.h"
 #include "proc.h"
+#include "poll.h"
 
 #define BACKSPACE 0x100
 #define C(x)  ((x)-'@')  // Control-x
@@ -50,6 +51,8 @@ struct {
   uint r;  // Read index
   uint w;  // Write index
   uint e;  // Edit index
+
+  struct pollwait *pollq;  // processes in poll()
 } cons;
 
 //
@@ -170,6 +173,7 @@ consoleintr(int c)
         // has arrived.
         cons.w = cons.e;
         wakeup(&cons.r);
+        pollwake(&cons.pollq);
       }
     }
     break;
@@ -178,6 +182,23 @@ consoleintr(int c)
   release(&cons.lock);
 }
 
+//
+// poll()s of the console go here. it is readable once a
+// whole line has arrived, and always writable.
+//
+int
+consolepoll(struct pollwait *w)
+{
+  int r = POLLOUT;
+
+  acquire(&cons.lock);
+  polladd(&cons.pollq, &cons.lock, w);
+  if(cons.r != cons.w)
+    r |= POLLIN;
+  release(&cons.lock);
+  return r;
+}
+
 void
 consoleinit(void)
 {
@@ -185,8 +206,9 @@ consoleinit(void)
 
   uartinit();
 
-  // connect read and write system calls
-  // to consoleread and consolewrite.
+  // connect read, write and poll system calls
+  // to consoleread, consolewrite and consolepoll.
   devsw[CONSOLE].read = consoleread;
   devsw[CONSOLE].write = consolewrite;
+  devsw[CONSOLE].poll = consolepoll;
 }
@@ -1,8 +1,11 @@
 struct buf;
 struct context;
+struct cpu;
 struct file;
 struct inode;
+struct iovec;
 struct pipe;
+struct pollwait;
 struct proc;
 struct spinlock;
 struct sleeplock;
@@ -12,10 +15,12 @@ struct superblock;
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+void            breadahead(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+int             statsbcache(char*, int);
 
 // console.c
 void            consoleinit(void);
@@ -24,15 +29,24 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+void            execinit(void);
+struct vmseg*   execseg(struct proc*, uint64);
+int             execfault(struct proc*, struct vmseg*, uint64);
+void            textinval(struct inode*);
+int             statsexec(char*, int);
 
 // file.c
 struct file*    filealloc(void);
 void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
-int             fileread(struct file*, uint64, int n);
+int             fileread(struct file*, int, uint64, int n);
 int             filestat(struct file*, uint64 addr);
-int             filewrite(struct file*, uint64, int n);
+int             filewrite(struct file*, int, uint64, int n);
+int             filereadv(struct file*, struct iovec*, int, uint*);
+int             filewritev(struct file*, struct iovec*, int, uint*);
+int             filesplice(struct file*, struct file*, int);
+int             filepoll(struct file*, struct pollwait*);
 
 // fs.c
 void            fsinit(int);
@@ -47,11 +61,14 @@ void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
+void            ncinval(struct inode*, char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
+int             statsfs(char*, int);
+int             statsncache(char*, int);
 void            itrunc(struct inode*);
 
 // ramdisk.c
@@ -63,18 +80,42 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void            kdup(void *);
+int             krefs(void *);
+void*           ksuperalloc(void);
+void            ksuperfree(void *);
+void            ksuperdup(void *);
+int             statskmem(char*, int);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
+void            begin_opn(int);
 void            end_op(void);
+void            end_opn(int);
+int             statslog(char*, int);
+
+// mmap.c
+uint64          mmap(uint64, int, int, struct file*, uint);
+int             munmap(uint64, uint64);
+struct vma*     vmafind(struct proc*, uint64);
+int             vmafault(struct proc*, struct vma*, uint64, int);
+int             vmafork(struct proc*, struct proc*);
+void            vmaexit(struct proc*);
+uint64          vmabase(struct proc*);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             piperead(struct pipe*, int, uint64, int);
+int             pipewrite(struct pipe*, int, uint64, int);
+int             pipepoll(struct pipe*, int, struct pollwait*);
+
+// poll.c
+void            polladd(struct pollwait**, struct spinlock*, struct pollwait*);
+void            pollwake(struct pollwait**);
+int             poll(uint64, int, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -102,7 +143,12 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
+void            wakeone(void*);
 void            yield(void);
+void            proctick(void);
+void            boost(void);
+int             nice(int);
+int             statssched(char*, int);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
@@ -114,9 +160,17 @@ void            swtch(struct context*, struct context*);
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            freelock(struct spinlock*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
+int             statslock(char*, int);
+
+// sprintf.c
+int             snprintf(char*, int, char*, ...);
+
+// stats.c
+void            statsinit(void);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
@@ -141,11 +195,18 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// timer.c
+void            clockinit(void);
+uint            uptime(void);
+void            timerstart(void);
+int             timerintr(void);
+struct cpu*     timeradd(uint64, void*);
+void            timerremove(struct proc*, struct cpu*);
+int             nsleep(uint64);
+int             statstimer(char*, int);
+
 // trap.c
-extern uint     ticks;
-void            trapinit(void);
 void            trapinithart(void);
-extern struct spinlock tickslock;
 void            usertrapret(void);
 
 // uart.c
@@ -160,11 +221,16 @@ void            kvminit(void);
 void            kvminithart(void);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
+int             mapsuper(pagetable_t, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcow(pagetable_t, uint64);
+int             uvmshare(pagetable_t, pagetable_t, uint64, uint64, int);
+int             vmfault(pagetable_t, uint64, int);
+void            vmprefault(uint64, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
@@ -173,6 +239,7 @@ uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
+int             statsvm(char*, int);
 
 // plic.c
 void            plicinit(void);
@@ -183,6 +250,9 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_start(struct buf *, int);
+void            virtio_disk_startv(struct buf **, int, int);
+void            virtio_disk_wait(struct buf *);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -6,8 +6,43 @@
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
 
-static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
+// exec() doesn't load the program. It records the loadable
+// segments in p->seg, and vmfault() reads in each page when
+// it is first touched. Pages of read-only segments (text)
+// are kept in a cache keyed by the file and offset, and every
+// process running the program maps the same physical page.
+// Writes to the file, and truncating or freeing it, drop its
+// pages from the cache; processes keep what they have mapped.
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+struct textpg {
+  uint dev;
+  uint inum;
+  uint off;      // offset in the file
+  uint n;        // bytes from the file; the rest is zero
+  uint64 pa;     // 0 if the entry is free
+  uint lastuse;
+};
+
+static struct {
+  struct spinlock lock;
+  struct textpg pg[NTEXTPG];  // each holds a reference to pa
+  uint clock;
+  int nhit;      // text faults that found the page cached
+  int nmiss;     // text faults that read the file
+  int ndata;     // faults that read a writable segment
+} text;
+
+void
+execinit(void)
+{
+  initlock(&text.lock, "text");
+}
 
 int flags2perm(int flags)
 {
@@ -23,11 +58,12 @@ int
 exec(char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
+  int i, off, nseg;
   uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *exe = 0, *oldexe;
   struct proghdr ph;
+  struct vmseg seg[NVMSEG];
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
@@ -49,7 +85,9 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Record the segments, to be paged in on demand. Each
+  // starts on a page of its own.
+  nseg = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -61,15 +99,23 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
+    if(ph.vaddr < sz || ph.vaddr + ph.memsz >= TRAPFRAME)
+      goto bad;
+    if(ph.off + ph.filesz < ph.off || ph.off + ph.filesz > ip->size)
       goto bad;
-    sz = sz1;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(nseg >= NVMSEG)
       goto bad;
+    seg[nseg].va = ph.vaddr;
+    seg[nseg].end = ph.vaddr + ph.memsz;
+    seg[nseg].off = ph.off;
+    seg[nseg].filesz = ph.filesz;
+    seg[nseg].perm = flags2perm(ph.flags);
+    nseg++;
+    sz = ph.vaddr + ph.memsz;
   }
-  iunlockput(ip);
+  iunlock(ip);
   end_op();
+  exe = ip;
   ip = 0;
 
   p = myproc();
@@ -120,13 +166,24 @@ exec(char *path, char **argv)
       last = s+1;
   safestrcpy(p->name, last, sizeof(p->name));
     
-  // Commit to the user image.
+  // Commit to the user image. The old image's mappings
+  // go with it.
+  vmaexit(p);
   oldpagetable = p->pagetable;
+  oldexe = p->exe;
   p->pagetable = pagetable;
   p->sz = sz;
+  p->exe = exe;
+  memmove(p->seg, seg, sizeof(seg));
+  p->nseg = nseg;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
   proc_freepagetable(oldpagetable, oldsz);
+  if(oldexe){
+    begin_op();
+    iput(oldexe);
+    end_op();
+  }
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
@@ -137,30 +194,183 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(exe){
+    begin_op();
+    iput(exe);
+    end_op();
+  }
   return -1;
 }
 
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
+// Return the segment of p's program holding va, or 0.
+struct vmseg*
+execseg(struct proc *p, uint64 va)
+{
+  struct vmseg *s;
+
+  for(s = p->seg; s < &p->seg[p->nseg]; s++)
+    if(va >= s->va && va < s->end)
+      return s;
+  return 0;
+}
+
+// Read n bytes at offset off of p's program into kernel
+// memory at dst. Reading may sleep, which isn't allowed while
+// holding a spinlock, nor while holding the program's inode
+// lock; see vmprefault().
 static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
+execread(struct proc *p, char *dst, uint off, uint n)
+{
+  int r;
+
+  if(intr_get() == 0 || holdingsleep(&p->exe->lock))
+    return -1;
+  ilock(p->exe);
+  r = readi(p->exe, 0, (uint64)dst, off, n);
+  iunlock(p->exe);
+  return r == n ? 0 : -1;
+}
+
+// Find the cached text page for n bytes at off in inode
+// (dev, inum). Caller must hold text.lock.
+static struct textpg*
+textfind(uint dev, uint inum, uint off, uint n)
 {
-  uint i, n;
+  struct textpg *t;
+
+  for(t = text.pg; t < &text.pg[NTEXTPG]; t++)
+    if(t->pa && t->dev == dev && t->inum == inum && t->off == off && t->n == n)
+      return t;
+  return 0;
+}
+
+// Return a page holding n bytes at off in p's program and
+// zeros after them, from the cache if possible, with a
+// reference for the caller. Returns 0 on error.
+static uint64
+textpage(struct proc *p, uint off, uint n)
+{
+  struct inode *ip = p->exe;
+  struct textpg *t, *x;
   uint64 pa;
+  char *mem;
 
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
+  acquire(&text.lock);
+  if((t = textfind(ip->dev, ip->inum, off, n)) != 0){
+    t->lastuse = ++text.clock;
+    kdup((void*)t->pa);
+    text.nhit++;
+    release(&text.lock);
+    return t->pa;
+  }
+  text.nmiss++;
+  release(&text.lock);
+
+  if(intr_get() == 0 || holdingsleep(&ip->lock))
+    return 0;  // see execread()
+  if((mem = kalloc()) == 0)
+    return 0;
+  memset(mem, 0, PGSIZE);
+  ilock(ip);
+  if(readi(ip, 0, (uint64)mem, off, n) != n){
+    iunlock(ip);
+    kfree(mem);
+    return 0;
+  }
+
+  // Cache the page before unlocking ip, so that a write
+  // to the file can't come between reading and caching.
+  acquire(&text.lock);
+  if((t = textfind(ip->dev, ip->inum, off, n)) != 0){
+    // Another process read it first.
+    kfree(mem);
+  } else {
+    t = &text.pg[0];
+    for(x = text.pg; x < &text.pg[NTEXTPG]; x++){
+      if(x->pa == 0){
+        t = x;
+        break;
+      }
+      if(x->lastuse < t->lastuse)
+        t = x;
+    }
+    if(t->pa)
+      kfree((void*)t->pa);
+    ip->text = 1;
+    t->dev = ip->dev;
+    t->inum = ip->inum;
+    t->off = off;
+    t->n = n;
+    t->pa = (uint64)mem;
+  }
+  t->lastuse = ++text.clock;
+  pa = t->pa;
+  kdup((void*)pa);
+  release(&text.lock);
+  iunlock(ip);
+  return pa;
+}
+
+// Read in and map the page holding va in segment s of p's
+// program. Returns 0 on success, -1 on failure.
+int
+execfault(struct proc *p, struct vmseg *s, uint64 va)
+{
+  uint64 pa;
+  uint pgoff, n;
+  char *mem;
+
+  va = PGROUNDDOWN(va);
+  pgoff = va - s->va;
+  n = pgoff < s->filesz ? min(PGSIZE, s->filesz - pgoff) : 0;
+
+  if(s->perm & PTE_W){
+    // A private copy.
+    if((mem = kalloc()) == 0)
+      return -1;
+    memset(mem, 0, PGSIZE);
+    if(n > 0 && execread(p, mem, s->off + pgoff, n) < 0){
+      kfree(mem);
       return -1;
+    }
+    __sync_fetch_and_add(&text.ndata, 1);
+    pa = (uint64)mem;
+  } else if((pa = textpage(p, s->off + pgoff, n)) == 0){
+    return -1;
+  }
+
+  if(mappages(p->pagetable, va, PGSIZE, pa, s->perm|PTE_R|PTE_U) != 0){
+    kfree((void*)pa);
+    return -1;
   }
-  
   return 0;
 }
+
+// Inode ip is changing: forget its cached pages.
+// Caller must hold ip->lock, as textpage() does while it
+// caches a page of ip, so that ip->text is up to date.
+void
+textinval(struct inode *ip)
+{
+  struct textpg *t;
+
+  if(ip->text == 0)
+    return;
+  ip->text = 0;
+  acquire(&text.lock);
+  for(t = text.pg; t < &text.pg[NTEXTPG]; t++){
+    if(t->pa && t->dev == ip->dev && t->inum == ip->inum){
+      kfree((void*)t->pa);
+      t->pa = 0;
+    }
+  }
+  release(&text.lock);
+}
+
+// Report demand paging activity for the statistics device.
+int
+statsexec(char *buf, int sz)
+{
+  return snprintf(buf, sz, "exec: text hits %d misses %d data faults %d\n",
+                  text.nhit, text.nmiss, text.ndata);
+}
@@ -12,6 +12,8 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "poll.h"
+#include "uio.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -101,27 +103,122 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// Read from f's inode into the niov buffers iov, in order,
+// at *off, or at f->off, moving it on, if off is 0.
+static int
+inoderead(struct file *f, int user, struct iovec *iov, int niov, uint *off)
+{
+  uint pos;
+  int i, r, n;
+
+  n = 0;
+  ilock(f->ip);
+  pos = off ? *off : f->off;
+  for(i = 0; i < niov; i++){
+    if((r = readi(f->ip, user, (uint64)iov[i].iov_base, pos, iov[i].iov_len)) < 0){
+      if(n == 0)
+        n = -1;
+      break;
+    }
+    pos += r;
+    n += r;
+    if(r < iov[i].iov_len)
+      break;
+  }
+  if(off == 0)
+    f->off = pos;
+  iunlock(f->ip);
+  return n;
+}
+
+// Write the niov buffers iov, in order, to f's inode, at *off,
+// or at f->off, moving it on, if off is 0.
+static int
+inodewrite(struct file *f, int user, struct iovec *iov, int niov, uint *off)
+{
+  // write as many blocks at a time as a big op may, to commit
+  // few transactions. reserve log space for the data blocks,
+  // as many again for extent tree and allocation blocks, the
+  // i-node, and 2 blocks of slop for non-aligned writes.
+  // this really belongs lower down, since writei()
+  // might be writing a device like the console.
+  int max = ((BIGOPBLOCKS-1-1-2) / 2) * BSIZE;
+  uint pos;
+  uint64 done;  // bytes of iov[i] written
+  int i, n, n1, m, r, left, want, nblocks;
+
+  n = 0;
+  for(i = 0; i < niov; i++)
+    n += iov[i].iov_len;
+
+  i = 0;
+  done = 0;
+  pos = off ? *off : 0;
+  r = m = 0;
+  for(left = n; left > 0; left -= n1){
+    want = left;
+    if(want > max)
+      want = max;
+    nblocks = (want + BSIZE-1) / BSIZE * 2 + 1 + 1 + 2;
+    if(nblocks < MAXOPBLOCKS)
+      nblocks = MAXOPBLOCKS;
+
+    begin_opn(nblocks);
+    ilock(f->ip);
+    if(off == 0)
+      pos = f->off;
+    for(n1 = 0; i < niov && n1 < want; n1 += m){
+      m = iov[i].iov_len - done;
+      if(m > want - n1)
+        m = want - n1;
+      if((r = writei(f->ip, user, (uint64)iov[i].iov_base + done, pos, m)) > 0)
+        pos += r;
+      if(r != m)
+        break;
+      done += m;
+      if(done == iov[i].iov_len){
+        i++;
+        done = 0;
+      }
+    }
+    if(off == 0)
+      f->off = pos;
+    iunlock(f->ip);
+    end_opn(nblocks);
+
+    if(r != m){
+      // error from writei
+      break;
+    }
+  }
+  return left == 0 ? n : -1;
+}
+
 // Read from file f.
-// addr is a user virtual address.
+// If user==1, addr is a user virtual address;
+// otherwise, addr is a kernel address.
 int
-fileread(struct file *f, uint64 addr, int n)
+fileread(struct file *f, int user, uint64 addr, int n)
 {
   int r = 0;
 
   if(f->readable == 0)
     return -1;
 
+  // Read in any program pages of the buffer now, since the
+  // copy happens with the file's locks held.
+  if(user)
+    vmprefault(addr, n);
+
   if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
+    r = piperead(f->pipe, user, addr, n);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
-    r = devsw[f->major].read(1, addr, n);
+    r = devsw[f->major].read(user, addr, n);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    struct iovec iov = { (void*)addr, n };
+    r = inoderead(f, user, &iov, 1, 0);
   } else {
     panic("fileread");
   }
@@ -130,49 +227,28 @@ fileread(struct file *f, uint64 addr, int n)
 }
 
 // Write to file f.
-// addr is a user virtual address.
+// If user==1, addr is a user virtual address;
+// otherwise, addr is a kernel address.
 int
-filewrite(struct file *f, uint64 addr, int n)
+filewrite(struct file *f, int user, uint64 addr, int n)
 {
-  int r, ret = 0;
+  int ret = 0;
 
   if(f->writable == 0)
     return -1;
 
+  if(user)
+    vmprefault(addr, n);
+
   if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
+    ret = pipewrite(f->pipe, user, addr, n);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
       return -1;
-    ret = devsw[f->major].write(1, addr, n);
+    ret = devsw[f->major].write(user, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
-
-      if(r != n1){
-        // error from writei
-        break;
-      }
-      i += r;
-    }
-    ret = (i == n ? n : -1);
+    struct iovec iov = { (void*)addr, n };
+    ret = inodewrite(f, user, &iov, 1, 0);
   } else {
     panic("filewrite");
   }
@@ -180,3 +256,129 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// Read from file f into the niov buffers at user addresses
+// in iov, in order, as one read. If off isn't 0, read at *off
+// without using or moving f->off; only a file in the file
+// system can be read that way.
+int
+filereadv(struct file *f, struct iovec *iov, int niov, uint *off)
+{
+  int i;
+
+  if(f->readable == 0)
+    return -1;
+  if(f->type == FD_INODE){
+    for(i = 0; i < niov; i++)
+      vmprefault((uint64)iov[i].iov_base, iov[i].iov_len);
+    return inoderead(f, 1, iov, niov, off);
+  }
+  if(off)
+    return -1;
+
+  // a pipe or device read waits until something is ready,
+  // and there may be nothing more after it; so fill just the
+  // first buffer with room, as read() would.
+  for(i = 0; i < niov; i++){
+    if(iov[i].iov_len > 0)
+      return fileread(f, 1, (uint64)iov[i].iov_base, iov[i].iov_len);
+  }
+  return 0;
+}
+
+// Write the niov buffers at user addresses in iov to file f,
+// in order, as one write; see filereadv().
+int
+filewritev(struct file *f, struct iovec *iov, int niov, uint *off)
+{
+  int i, r, n;
+
+  if(f->writable == 0)
+    return -1;
+  if(f->type == FD_INODE){
+    for(i = 0; i < niov; i++)
+      vmprefault((uint64)iov[i].iov_base, iov[i].iov_len);
+    return inodewrite(f, 1, iov, niov, off);
+  }
+  if(off)
+    return -1;
+
+  n = 0;
+  for(i = 0; i < niov; i++){
+    if((r = filewrite(f, 1, (uint64)iov[i].iov_base, iov[i].iov_len)) < 0)
+      return -1;
+    n += r;
+    if(r < iov[i].iov_len)
+      break;
+  }
+  return n;
+}
+
+// Which of POLLIN, POLLOUT, POLLERR and POLLHUP hold for f.
+// Puts w on f's list of pollers, if f has one.
+int
+filepoll(struct file *f, struct pollwait *w)
+{
+  if(f->type == FD_PIPE)
+    return pipepoll(f->pipe, f->writable, w);
+  if(f->type == FD_DEVICE && f->major >= 0 && f->major < NDEV &&
+     devsw[f->major].poll)
+    return devsw[f->major].poll(w);
+  // reads and writes of other files don't wait for anything.
+  return POLLIN | POLLOUT;
+}
+
+// Move up to n bytes from in to out, between pipes and
+// files, without copying them through user memory.
+// Stops early at the end of in, or when a pipe in has no
+// more data ready, or if out takes less than it's given.
+// Data that out doesn't take is left in a file in, but is
+// lost from a pipe in.
+// Returns the number of bytes moved, or -1 if none were
+// because of an error.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  char *buf;
+  int m, r, w, total, err;
+
+  if((in->type != FD_PIPE && in->type != FD_INODE) ||
+     (out->type != FD_PIPE && out->type != FD_INODE))
+    return -1;
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if((buf = kalloc()) == 0)
+    return -1;
+
+  total = 0;
+  err = 0;
+  while(total < n){
+    m = n - total;
+    if(m > PGSIZE)
+      m = PGSIZE;
+    if((r = fileread(in, 0, (uint64)buf, m)) <= 0){
+      err = r < 0;
+      break;
+    }
+    if((w = filewrite(out, 0, (uint64)buf, r)) < 0){
+      err = 1;
+      w = 0;
+    }
+    total += w;
+    if(w < r){
+      // give a file back what out didn't take, so that a
+      // retry doesn't skip it. a pipe can't take it back.
+      if(in->type == FD_INODE){
+        ilock(in->ip);
+        in->off -= r - w;
+        iunlock(in->ip);
+      }
+      break;
+    }
+    if(r < m)
+      break;
+  }
+  kfree(buf);
+  if(total == 0 && err)
+    return -1;
+  return total;
+}
@@ -26,15 +26,39 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint extroot;
+  struct extent ext[NIEXTENT];
+  struct extent ecache;  // last extent bmap found
+
+  uint ra_next;       // block after the last one readi read
+  uint ra_win;        // readahead window, in blocks
+  uint ra_end;        // readahead issued up to here
+  int text;           // may have pages in exec.c's text cache
+};
+
+// a process in poll(), waiting for any of several files.
+struct poller {
+  struct cpu *c;  // c->tlock protects woken
+  int woken;
+};
+
+// a poller's place on a pipe's or device's list of pollers,
+// one for each file it polls.
+struct pollwait {
+  struct poller *pl;
+  struct spinlock *lk;    // the lock that protects the list
+  struct pollwait **q;    // the list, or 0 if not on it yet
+  struct pollwait *next;
 };
 
 // map major device number to device functions.
 struct devsw {
   int (*read)(int, uint64, int);
   int (*write)(int, uint64, int);
+  int (*poll)(struct pollwait*);  // POLL* bits ready, see poll.h
 };
 
 extern struct devsw devsw[];
 
 #define CONSOLE 1
+#define STATS   2
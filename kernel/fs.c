@@ -60,33 +60,92 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
-// returns 0 if out of disk space.
+// Allocation statistics, and where to look for free blocks
+// when there is no better idea. The rotor is only a hint, so
+// it isn't locked.
+static struct {
+  uint rotor;
+  int nblocks;   // blocks allocated
+  int nruns;     // runs allocated
+  int ngoal;     // runs that started at their goal
+  int nextents;  // extents created
+} alloc;
+
+// Find the first free block in [from, to), and mark it and up
+// to want-1 free blocks right after it in use, all in one
+// bitmap block. Returns the first block and sets *n to the
+// length of the run, or returns 0 if there is no free block.
 static uint
-balloc(uint dev)
+bscan(uint dev, uint from, uint to, uint want, uint *n)
 {
-  int b, bi, m;
+  uint b, bi, m, first;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
+  for(b = from - from % BPB; b < to; b += BPB){
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
+    bi = b < from ? from - b : 0;
+    for(; bi < BPB && b + bi < to; bi++){
       m = 1 << (bi % 8);
       if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
+        first = b + bi;
+        *n = 0;
+        do {
+          bp->data[bi/8] |= m;  // Mark block in use.
+          (*n)++;
+          bi++;
+          m = 1 << (bi % 8);
+        } while(*n < want && bi < BPB && b + bi < to &&
+                (bp->data[bi/8] & m) == 0);
         log_write(bp);
         brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+        return first;
       }
     }
     brelse(bp);
   }
-  printf("balloc: out of blocks\n");
   return 0;
 }
 
+// Allocate a run of up to want consecutive zeroed disk blocks,
+// starting at goal if it is free or else at the next free block
+// after it; with no goal, start where the last run ended.
+// Returns the first block and sets *n to the run's length.
+// returns 0 if out of disk space.
+static uint
+ballocrun(uint dev, uint goal, uint want, uint *n)
+{
+  uint b, i;
+
+  if(goal == 0)
+    goal = alloc.rotor;
+  if(goal >= sb.size)
+    goal = 0;
+  // block 0 is the boot block, never free.
+  if((b = bscan(dev, goal, sb.size, want, n)) == 0 &&
+     (b = bscan(dev, 0, goal, want, n)) == 0){
+    printf("balloc: out of blocks\n");
+    return 0;
+  }
+  for(i = 0; i < *n; i++)
+    bzero(dev, b + i);
+  alloc.rotor = b + *n;
+  __sync_fetch_and_add(&alloc.nblocks, *n);
+  __sync_fetch_and_add(&alloc.nruns, 1);
+  if(b == goal)
+    __sync_fetch_and_add(&alloc.ngoal, 1);
+  return b;
+}
+
+// Allocate a zeroed disk block.
+// returns 0 if out of disk space.
+static uint
+balloc(uint dev)
+{
+  uint n;
+
+  return ballocrun(dev, 0, 1, &n);
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
@@ -104,6 +163,30 @@ bfree(int dev, uint b)
   brelse(bp);
 }
 
+// Free n disk blocks starting at b, reading each bitmap
+// block once.
+static void
+bfreerun(int dev, uint b, uint n)
+{
+  struct buf *bp;
+  uint bi, m;
+
+  while(n > 0){
+    bp = bread(dev, BBLOCK(b, sb));
+    do {
+      bi = b % BPB;
+      m = 1 << (bi % 8);
+      if((bp->data[bi/8] & m) == 0)
+        panic("freeing free block");
+      bp->data[bi/8] &= ~m;
+      b++;
+      n--;
+    } while(n > 0 && b % BPB != 0);
+    log_write(bp);
+    brelse(bp);
+  }
+}
+
 // Inodes.
 //
 // An inode describes a single unnamed file.
@@ -178,18 +261,42 @@ struct {
   struct inode inode[NINODE];
 } itable;
 
+// Name cache; see namex().
+#define NNCBUCKET 31
+
+struct ncentry {
+  uint dev;
+  uint dinum;            // directory, or 0 if the entry is free
+  char name[DIRSIZ];
+  uint inum;             // what name is in dinum; 0 if no such name
+  uint lastuse;
+  struct ncentry *next;  // hash chain
+};
+
+static struct {
+  struct spinlock lock;
+  struct ncentry entry[NNCACHE];
+  struct ncentry *bucket[NNCBUCKET];
+  uint clock;    // advances on each use of an entry
+  int nhit;      // lookups that found an inode
+  int nneg;      // lookups that found no such name
+  int nmiss;     // lookups that had to read the directory
+} ncache;
+
 void
 iinit()
 {
   int i = 0;
   
   initlock(&itable.lock, "itable");
+  initlock(&ncache.lock, "ncache");
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&itable.inode[i].lock, "inode");
   }
 }
 
 static struct inode* iget(uint dev, uint inum);
+static void ncpurge(uint dev, uint inum);
 
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
@@ -235,7 +342,8 @@ iupdate(struct inode *ip)
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
-  memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
+  dip->extroot = ip->extroot;
+  memmove(dip->ext, ip->ext, sizeof(ip->ext));
   log_write(bp);
   brelse(bp);
 }
@@ -308,8 +416,14 @@ ilock(struct inode *ip)
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+    ip->extroot = dip->extroot;
+    memmove(ip->ext, dip->ext, sizeof(ip->ext));
+    ip->ecache.len = 0;
     brelse(bp);
+    ip->ra_next = 0;
+    ip->ra_win = 0;
+    ip->ra_end = 0;
+    ip->text = 1;  // pages cached before it was last in memory
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -347,6 +461,9 @@ iput(struct inode *ip)
 
     release(&itable.lock);
 
+    // No one else can reach ip to cache names in it,
+    // so drop the names it held before its inum is reused.
+    ncpurge(ip->dev, ip->inum);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
@@ -372,52 +489,271 @@ iunlockput(struct inode *ip)
 // Inode content
 //
 // The content (data) associated with each inode is stored
-// in blocks on the disk. The first NDIRECT block numbers
-// are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// in runs of consecutive blocks on the disk, called extents.
+// The first NIEXTENT extents are listed in ip->ext[]. Any
+// more are in a tree of extent blocks rooted at block
+// ip->extroot; see struct extnode in fs.h.
 
-// Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
-// returns 0 if out of disk space.
-static uint
-bmap(struct inode *ip, uint bn)
+#define EXTMAXDEPTH 4
+
+// Does extent e hold block bn?
+static int
+inext(struct extent *e, uint bn)
+{
+  return e->len > 0 && bn >= e->lblk && bn - e->lblk < e->len;
+}
+
+// Return the entry of an extent tree node that covers bn:
+// the last one whose lblk is at most bn.
+static struct extent*
+extsearch(struct extnode *node, uint bn)
+{
+  int lo, hi, mid;
+
+  lo = 0;
+  hi = node->n - 1;
+  while(lo < hi){
+    mid = (lo + hi + 1) / 2;
+    if(node->ext[mid].lblk <= bn)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return &node->ext[lo];
+}
+
+// Copy the extent holding block bn of ip to *e.
+// Returns 0 if bn is past the end of the file's blocks.
+static int
+extlookup(struct inode *ip, uint bn, struct extent *e)
 {
-  uint addr, *a;
   struct buf *bp;
+  struct extnode *node;
+  struct extent *x;
+  uint addr;
+  int i, found;
+
+  if(inext(&ip->ecache, bn)){
+    *e = ip->ecache;
+    return 1;
+  }
+  for(i = 0; i < NIEXTENT; i++){
+    if(inext(&ip->ext[i], bn)){
+      *e = ip->ecache = ip->ext[i];
+      return 1;
+    }
+  }
 
-  if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[bn] = addr;
+  found = 0;
+  for(addr = ip->extroot; addr != 0; ){
+    bp = bread(ip->dev, addr);
+    node = (struct extnode*)bp->data;
+    x = extsearch(node, bn);
+    addr = 0;
+    if(node->depth > 0){
+      addr = x->start;
+    } else if(inext(x, bn)){
+      *e = ip->ecache = *x;
+      found = 1;
     }
-    return addr;
+    brelse(bp);
   }
-  bn -= NDIRECT;
+  return found;
+}
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[NDIRECT] = addr;
+// Initialize a new extent tree block holding just e.
+static void
+extinit(uint dev, uint addr, uint depth, struct extent e)
+{
+  struct buf *bp;
+  struct extnode *node;
+
+  bp = bread(dev, addr);
+  node = (struct extnode*)bp->data;
+  node->depth = depth;
+  node->n = 1;
+  node->ext[0] = e;
+  log_write(bp);
+  brelse(bp);
+}
+
+// Allocate disk blocks for ip from the end of the file's
+// extents up to block lastbn, as one run of consecutive blocks
+// if possible. The run extends the last extent if it follows
+// it on disk, and otherwise becomes a new extent at the end of
+// the inode's extents or of the extent tree.
+// Returns the number of blocks allocated, which may be fewer
+// than asked for; 0 if out of disk space.
+static uint
+extalloc(struct inode *ip, uint lastbn)
+{
+  struct buf *bp;
+  struct extnode *node;
+  struct extent last, e;
+  uint path[EXTMAXDEPTH], newnode[EXTMAXDEPTH+1], addr, goal, rootlblk, bn, n;
+  int i, d, f, nnew;
+
+  if(ip->extroot == 0){
+    for(i = NIEXTENT; i > 0 && ip->ext[i-1].len == 0; i--)
+      ;
+    if(i == 0){
+      last.lblk = last.start = last.len = 0;
+      goal = 0;
+    } else {
+      last = ip->ext[i-1];
+      goal = last.start + last.len;
+    }
+    bn = last.lblk + last.len;
+    if(lastbn < bn)
+      panic("extalloc");
+    if((addr = ballocrun(ip->dev, goal, lastbn - bn + 1, &n)) == 0)
+      return 0;
+    if(i > 0 && addr == goal){
+      ip->ext[i-1].len += n;
+      ip->ecache = ip->ext[i-1];
+      return n;
+    }
+    e.lblk = bn;
+    e.start = addr;
+    e.len = n;
+    __sync_fetch_and_add(&alloc.nextents, 1);
+    if(i < NIEXTENT){
+      ip->ext[i] = ip->ecache = e;
+      return n;
     }
+    // The inode is full; start the extent tree.
+    if((ip->extroot = balloc(ip->dev)) == 0){
+      bfreerun(ip->dev, addr, n);
+      return 0;
+    }
+    extinit(ip->dev, ip->extroot, 0, e);
+    ip->ecache = e;
+    return n;
+  }
+
+  // Walk down the rightmost path of the tree, counting how
+  // many full nodes are at the bottom of it.
+  addr = ip->extroot;
+  rootlblk = 0;
+  f = 0;
+  for(d = 0; ; d++){
+    if(d >= EXTMAXDEPTH)
+      panic("extalloc: tree too deep");
+    path[d] = addr;
     bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr){
-        a[bn] = addr;
-        log_write(bp);
-      }
+    node = (struct extnode*)bp->data;
+    if(d == 0)
+      rootlblk = node->ext[0].lblk;
+    f = node->n == NEXTPB ? f + 1 : 0;
+    last = node->ext[node->n-1];
+    brelse(bp);
+    if(node->depth == 0)
+      break;
+    addr = last.start;
+  }
+  d++;  // number of levels
+
+  bn = last.lblk + last.len;
+  if(lastbn < bn)
+    panic("extalloc");
+  goal = last.start + last.len;
+  if((addr = ballocrun(ip->dev, goal, lastbn - bn + 1, &n)) == 0)
+    return 0;
+  e.lblk = bn;
+  e.start = addr;
+  e.len = n;
+  if(addr != goal)
+    __sync_fetch_and_add(&alloc.nextents, 1);
+
+  if(addr == goal || f == 0){
+    bp = bread(ip->dev, path[d-1]);
+    node = (struct extnode*)bp->data;
+    if(addr == goal)
+      node->ext[node->n-1].len += n;
+    else
+      node->ext[node->n++] = e;
+    ip->ecache = node->ext[node->n-1];
+    log_write(bp);
+    brelse(bp);
+    return n;
+  }
+
+  // The leaf is full, and perhaps some of the nodes above it:
+  // give each full node a new sibling on its right, and if the
+  // root is full, add a new root above it and its sibling.
+  nnew = f == d ? f + 1 : f;
+  for(i = 0; i < nnew; i++){
+    if((newnode[i] = balloc(ip->dev)) == 0){
+      while(--i >= 0)
+        bfree(ip->dev, newnode[i]);
+      bfreerun(ip->dev, addr, n);
+      return 0;
     }
+  }
+  ip->ecache = e;
+  for(i = 0; i < f; i++){
+    extinit(ip->dev, newnode[i], i, e);
+    e.start = newnode[i];
+    e.len = 0;
+  }
+  if(f < d){
+    bp = bread(ip->dev, path[d-1-f]);
+    node = (struct extnode*)bp->data;
+    node->ext[node->n++] = e;
+    log_write(bp);
     brelse(bp);
-    return addr;
+  } else {
+    if(d >= EXTMAXDEPTH)
+      panic("extalloc: tree too deep");
+    extinit(ip->dev, newnode[f], d, e);
+    bp = bread(ip->dev, newnode[f]);
+    node = (struct extnode*)bp->data;
+    node->ext[1] = node->ext[0];
+    node->ext[0].lblk = rootlblk;
+    node->ext[0].start = ip->extroot;
+    node->ext[0].len = 0;
+    node->n = 2;
+    log_write(bp);
+    brelse(bp);
+    ip->extroot = newnode[f];
+  }
+  return n;
+}
+
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block, bmap allocates the blocks up to
+// it, since files have no holes.
+// returns 0 if out of disk space.
+static uint
+bmap(struct inode *ip, uint bn)
+{
+  struct extent e;
+
+  while(!extlookup(ip, bn, &e)){
+    if(extalloc(ip, bn) == 0)
+      return 0;
   }
+  return e.start + (bn - e.lblk);
+}
+
 
-  panic("bmap: out of range");
+// Free extent tree block addr and all the blocks it maps.
+static void
+extfree(uint dev, uint addr)
+{
+  struct buf *bp;
+  struct extnode *node;
+
+  bp = bread(dev, addr);
+  node = (struct extnode*)bp->data;
+  for(int i = 0; i < node->n; i++){
+    if(node->depth > 0)
+      extfree(dev, node->ext[i].start);
+    else
+      bfreerun(dev, node->ext[i].start, node->ext[i].len);
+  }
+  brelse(bp);
+  bfree(dev, addr);
 }
 
 // Truncate inode (discard contents).
@@ -425,31 +761,42 @@ bmap(struct inode *ip, uint bn)
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
 
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
-    }
+  for(i = 0; i < NIEXTENT; i++){
+    bfreerun(ip->dev, ip->ext[i].start, ip->ext[i].len);
+    memset(&ip->ext[i], 0, sizeof(ip->ext[i]));
   }
-
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+  if(ip->extroot){
+    extfree(ip->dev, ip->extroot);
+    ip->extroot = 0;
   }
+  ip->ecache.len = 0;
 
   ip->size = 0;
   iupdate(ip);
+  textinval(ip);
+}
+
+// Directory statistics.
+static struct {
+  int nindexed;  // lookups through a directory index
+  int nlinear;   // lookups by scanning a directory
+  int nsplit;    // index leaves split
+} dirstats;
+
+// Report how contiguous allocation has been, and how
+// directories are searched, for the statistics device.
+int
+statsfs(char *buf, int sz)
+{
+  int n;
+
+  n = snprintf(buf, sz, "balloc: blocks %d runs %d at goal %d extents %d\n",
+               alloc.nblocks, alloc.nruns, alloc.ngoal, alloc.nextents);
+  n += snprintf(buf+n, sz-n, "dir: indexed lookups %d linear lookups %d splits %d\n",
+                dirstats.nindexed, dirstats.nlinear, dirstats.nsplit);
+  return n;
 }
 
 // Copy stat information from inode.
@@ -464,6 +811,40 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Sequential readahead. readi is about to read block bn of ip.
+// While ip is being read block after block, keep the next
+// ra_win blocks on their way into the buffer cache, doubling
+// the window on each new block up to RAMAX. A read anywhere
+// else closes the window. Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint bn)
+{
+  uint b, last, addr;
+
+  if(bn + 1 == ip->ra_next)
+    return;   // same block again
+  if(bn == ip->ra_next){
+    ip->ra_win = ip->ra_win ? min(ip->ra_win * 2, RAMAX) : 2;
+  } else {
+    ip->ra_win = 0;
+    ip->ra_end = bn + 1;
+  }
+  ip->ra_next = bn + 1;
+  if(ip->ra_win == 0)
+    return;
+
+  // Only blocks the file already has, so bmap won't allocate.
+  last = min(bn + ip->ra_win, (ip->size + BSIZE - 1) / BSIZE - 1);
+  if(ip->ra_end < bn + 1)
+    ip->ra_end = bn + 1;
+  for(b = ip->ra_end; b <= last; b++){
+    if((addr = bmap(ip, b)) == 0)
+      break;
+    breadahead(ip->dev, addr);
+  }
+  ip->ra_end = b;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -483,6 +864,7 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
       break;
+    readahead(ip, off/BSIZE);
     bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
@@ -512,6 +894,13 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  if(n > 0 && ip->type == T_FILE)
+    textinval(ip);
+
+  // Allocate any new blocks in as few runs as possible.
+  // If the disk is full, the loop below writes what fits.
+  if(n > 0)
+    bmap(ip, (off + n - 1) / BSIZE);
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     uint addr = bmap(ip, off/BSIZE);
@@ -532,7 +921,7 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 
   // write the i-node back to disk even if the size didn't change
   // because the loop above might have called bmap() and added a new
-  // block to ip->addrs[].
+  // block to ip->ext[].
   iupdate(ip);
 
   return tot;
@@ -546,6 +935,258 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Indexed directories; see struct dxroot in fs.h.
+
+#define DXHASH(r, i) ((r)->slot[(i)/2].hash[(i)%2])
+#define DXBLK(r, i)  ((r)->slot[(i)/2].blk[(i)%2])
+
+// Hash a directory entry name (FNV-1a).
+// mkfs has a copy, which must agree with this one.
+static uint
+dxhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+// Return a buffer holding block 0 of directory dp,
+// or 0 if dp is not indexed.
+static struct buf*
+dxread(struct inode *dp)
+{
+  struct buf *bp;
+  struct dxroot *root;
+  uint addr;
+
+  if(dp->size < BSIZE || (addr = bmap(dp, 0)) == 0)
+    return 0;
+  bp = bread(dp->dev, addr);
+  root = (struct dxroot*)bp->data;
+  if(root->zero != 0 || root->magic != DXMAGIC){
+    brelse(bp);
+    return 0;
+  }
+  return bp;
+}
+
+// Return the index entry whose range holds hash h: the last
+// one whose hash is at most h. Entry 0's hash is 0.
+static int
+dxfind(struct dxroot *root, uint h)
+{
+  int lo, hi, mid;
+
+  lo = 0;
+  hi = root->nent - 1;
+  while(lo < hi){
+    mid = (lo + hi + 1) / 2;
+    if(DXHASH(root, mid) <= h)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return lo;
+}
+
+// Read leaf block blk of directory dp.
+static struct buf*
+dxleaf(struct inode *dp, uint blk)
+{
+  uint addr;
+
+  if((addr = bmap(dp, blk)) == 0)
+    panic("dxleaf");
+  return bread(dp->dev, addr);
+}
+
+// Look for name in indexed directory dp, whose block 0 is in
+// rbp. Returns its inum and sets *poff, or returns 0.
+static uint
+dxlookup(struct inode *dp, struct buf *rbp, char *name, uint *poff)
+{
+  struct dxroot *root;
+  struct dirent *de;
+  struct buf *bp;
+  uint blk, inum;
+  int i;
+
+  root = (struct dxroot*)rbp->data;
+  if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0){
+    de = namecmp(name, ".") == 0 ? &root->dot : &root->dotdot;
+    if(poff)
+      *poff = (char*)de - (char*)root;
+    return de->inum;
+  }
+  if(root->nent == 0)
+    return 0;
+
+  blk = DXBLK(root, dxfind(root, dxhash(name)));
+  bp = dxleaf(dp, blk);
+  de = (struct dirent*)bp->data;
+  inum = 0;
+  for(i = 0; i < DPB; i++){
+    if(de[i].inum != 0 && namecmp(name, de[i].name) == 0){
+      if(poff)
+        *poff = blk*BSIZE + i*sizeof(*de);
+      inum = de[i].inum;
+      break;
+    }
+  }
+  brelse(bp);
+  return inum;
+}
+
+// Add a zeroed block to the end of directory dp.
+// Returns its block number in dp, or -1 if out of disk space.
+static int
+dxgrow(struct inode *dp)
+{
+  uint blk;
+
+  blk = dp->size / BSIZE;
+  if(blk >= MAXFILE || bmap(dp, blk) == 0)
+    return -1;
+  dp->size += BSIZE;
+  iupdate(dp);
+  return blk;
+}
+
+// Make empty directory dp an indexed one with no leaves.
+static int
+dxinit(struct inode *dp)
+{
+  struct buf *bp;
+
+  if(dxgrow(dp) != 0)
+    return -1;
+  bp = dxleaf(dp, 0);
+  ((struct dxroot*)bp->data)->magic = DXMAGIC;
+  log_write(bp);
+  brelse(bp);
+  return 0;
+}
+
+// Index entry i of directory dp, whose block 0 is in rbp,
+// points at a full leaf, held in lbp. Move the names with the
+// larger hashes to a new leaf, with a new index entry after i.
+// Names with the same hash stay together.
+// Returns -1 if the index or the disk is full, or if all the
+// names in the leaf hash alike.
+static int
+dxsplit(struct inode *dp, struct buf *rbp, int i, struct buf *lbp)
+{
+  struct dxroot *root;
+  struct dirent *de, *nde;
+  struct buf *nbp;
+  uint hash[DPB], sorted[DPB], h, split;
+  int blk, j, k;
+
+  root = (struct dxroot*)rbp->data;
+  if(root->nent >= NDXENT)
+    return -1;
+
+  // Split at the median hash, or failing that at the
+  // smallest hash above the lowest one.
+  de = (struct dirent*)lbp->data;
+  for(j = 0; j < DPB; j++){
+    hash[j] = dxhash(de[j].name);
+    h = hash[j];
+    for(k = j; k > 0 && sorted[k-1] > h; k--)
+      sorted[k] = sorted[k-1];
+    sorted[k] = h;
+  }
+  for(j = DPB/2; j < DPB && sorted[j] == sorted[0]; j++)
+    ;
+  if(j == DPB)
+    return -1;
+  split = sorted[j];
+
+  if((blk = dxgrow(dp)) < 0)
+    return -1;
+  nbp = dxleaf(dp, blk);
+  nde = (struct dirent*)nbp->data;
+  for(j = k = 0; j < DPB; j++){
+    if(hash[j] >= split){
+      nde[k++] = de[j];
+      memset(&de[j], 0, sizeof(de[j]));
+    }
+  }
+  log_write(nbp);
+  brelse(nbp);
+  log_write(lbp);
+
+  for(j = root->nent; j > i + 1; j--){
+    DXHASH(root, j) = DXHASH(root, j-1);
+    DXBLK(root, j) = DXBLK(root, j-1);
+  }
+  DXHASH(root, i+1) = split;
+  DXBLK(root, i+1) = blk;
+  root->nent++;
+  log_write(rbp);
+  __sync_fetch_and_add(&dirstats.nsplit, 1);
+  return 0;
+}
+
+// Add (name, inum) to indexed directory dp, whose block 0 is
+// in rbp. The caller has checked that name is not present.
+static int
+dxlink(struct inode *dp, struct buf *rbp, char *name, uint inum)
+{
+  struct dxroot *root;
+  struct dirent *de;
+  struct buf *bp;
+  uint h;
+  int blk, i, j;
+
+  root = (struct dxroot*)rbp->data;
+  if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0){
+    de = namecmp(name, ".") == 0 ? &root->dot : &root->dotdot;
+    strncpy(de->name, name, DIRSIZ);
+    de->inum = inum;
+    log_write(rbp);
+    return 0;
+  }
+
+  if(root->nent == 0){
+    if((blk = dxgrow(dp)) < 0)
+      return -1;
+    DXHASH(root, 0) = 0;
+    DXBLK(root, 0) = blk;
+    root->nent = 1;
+    log_write(rbp);
+  }
+
+  h = dxhash(name);
+  for(;;){
+    i = dxfind(root, h);
+    bp = dxleaf(dp, DXBLK(root, i));
+    de = (struct dirent*)bp->data;
+    for(j = 0; j < DPB; j++){
+      if(de[j].inum == 0){
+        strncpy(de[j].name, name, DIRSIZ);
+        de[j].inum = inum;
+        log_write(bp);
+        brelse(bp);
+        return 0;
+      }
+    }
+    // Both halves of a split leaf have room, so this
+    // loops at most twice.
+    if(dxsplit(dp, rbp, i, bp) < 0){
+      brelse(bp);
+      return -1;
+    }
+    brelse(bp);
+  }
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
@@ -553,10 +1194,20 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 {
   uint off, inum;
   struct dirent de;
+  struct buf *bp;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  if((bp = dxread(dp)) != 0){
+    __sync_fetch_and_add(&dirstats.nindexed, 1);
+    inum = dxlookup(dp, bp, name, poff);
+    brelse(bp);
+    return inum ? iget(dp->dev, inum) : 0;
+  }
+
+  // A directory from an older mkfs: scan it.
+  __sync_fetch_and_add(&dirstats.nlinear, 1);
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -575,13 +1226,15 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
+// A new, empty directory becomes an indexed one.
 // Returns 0 on success, -1 on failure (e.g. out of disk blocks).
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
+  int off, r;
   struct dirent de;
   struct inode *ip;
+  struct buf *bp;
 
   // Check that name is not present.
   if((ip = dirlookup(dp, name, 0)) != 0){
@@ -589,6 +1242,14 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
+  if(dp->size == 0 && dxinit(dp) < 0)
+    return -1;
+  if((bp = dxread(dp)) != 0){
+    r = dxlink(dp, bp, name, inum);
+    brelse(bp);
+    return r;
+  }
+
   // Look for an empty dirent.
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
@@ -644,9 +1305,146 @@ skipelem(char *path, char *name)
   return path;
 }
 
+// The name cache remembers what namex() found when it looked
+// up a name in a directory: an inum, or that there was no such
+// name. Entries are added with the directory locked, and
+// sysfile.c calls ncinval() with the directory locked whenever
+// it adds or removes a name, so an entry never outlives the
+// directory entry it describes. When the cache is full, a new
+// entry replaces the least recently used one.
+
+static struct ncentry**
+nchash(uint dev, uint dinum, char *name)
+{
+  return &ncache.bucket[(dxhash(name) + dinum * 31 + dev) % NNCBUCKET];
+}
+
+// Find the entry for name in directory dinum.
+// Caller must hold ncache.lock.
+static struct ncentry*
+ncfind(uint dev, uint dinum, char *name)
+{
+  struct ncentry *e;
+
+  for(e = *nchash(dev, dinum, name); e; e = e->next)
+    if(e->dev == dev && e->dinum == dinum && namecmp(e->name, name) == 0)
+      return e;
+  return 0;
+}
+
+// Take e off its hash chain and free it.
+// Caller must hold ncache.lock.
+static void
+ncremove(struct ncentry *e)
+{
+  struct ncentry **pp;
+
+  for(pp = nchash(e->dev, e->dinum, e->name); *pp != e; pp = &(*pp)->next)
+    ;
+  *pp = e->next;
+  e->dinum = 0;
+}
+
+// Look up name in directory dp in the name cache.
+// Returns 0 if it isn't there. Otherwise sets *ipp to the
+// inode the name refers to, or to 0 if dp has no such name.
+// The inode is referenced before the entry can be
+// invalidated, so it can't be freed under the caller.
+static int
+ncget(struct inode *dp, char *name, struct inode **ipp)
+{
+  struct ncentry *e;
+
+  acquire(&ncache.lock);
+  if((e = ncfind(dp->dev, dp->inum, name)) == 0){
+    ncache.nmiss++;
+    release(&ncache.lock);
+    return 0;
+  }
+  e->lastuse = ++ncache.clock;
+  if(e->inum == 0){
+    ncache.nneg++;
+    *ipp = 0;
+  } else {
+    ncache.nhit++;
+    *ipp = iget(dp->dev, e->inum);
+  }
+  release(&ncache.lock);
+  return 1;
+}
+
+// Remember that name in directory dp refers to inum, or to
+// nothing if inum is 0. Caller must hold dp->lock.
+static void
+ncput(struct inode *dp, char *name, uint inum)
+{
+  struct ncentry *e, *x, **bp;
+
+  acquire(&ncache.lock);
+  if((e = ncfind(dp->dev, dp->inum, name)) == 0){
+    e = &ncache.entry[0];
+    for(x = ncache.entry; x < ncache.entry+NNCACHE; x++){
+      if(x->dinum == 0){
+        e = x;
+        break;
+      }
+      if(x->lastuse < e->lastuse)
+        e = x;
+    }
+    if(e->dinum != 0)
+      ncremove(e);
+    e->dev = dp->dev;
+    e->dinum = dp->inum;
+    strncpy(e->name, name, DIRSIZ);
+    bp = nchash(e->dev, e->dinum, e->name);
+    e->next = *bp;
+    *bp = e;
+  }
+  e->inum = inum;
+  e->lastuse = ++ncache.clock;
+  release(&ncache.lock);
+}
+
+// Forget what the cache knows about name in directory dp,
+// which is about to change. Caller must hold dp->lock.
+void
+ncinval(struct inode *dp, char *name)
+{
+  struct ncentry *e;
+
+  acquire(&ncache.lock);
+  if((e = ncfind(dp->dev, dp->inum, name)) != 0)
+    ncremove(e);
+  release(&ncache.lock);
+}
+
+// Inode inum is being freed: forget the names in it, and
+// any that still refer to it.
+static void
+ncpurge(uint dev, uint inum)
+{
+  struct ncentry *e;
+
+  acquire(&ncache.lock);
+  for(e = ncache.entry; e < ncache.entry+NNCACHE; e++)
+    if(e->dinum != 0 && e->dev == dev && (e->dinum == inum || e->inum == inum))
+      ncremove(e);
+  release(&ncache.lock);
+}
+
+// Report name cache hit rates, for the statistics device.
+int
+statsncache(char *buf, int sz)
+{
+  return snprintf(buf, sz, "ncache: hit %d negative %d miss %d\n",
+                  ncache.nhit, ncache.nneg, ncache.nmiss);
+}
+
 // Look up and return the inode for a path name.
 // If parent != 0, return the inode for the parent and copy the final
 // path element into name, which must have room for DIRSIZ bytes.
+// Each step consults the name cache first; only a miss locks
+// the directory and reads it.
 // Must be called inside a transaction since it calls iput().
 static struct inode*
 namex(char *path, int nameiparent, char *name)
@@ -659,6 +1457,15 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
+    // Only directories have names in the cache, so a hit
+    // needn't check ip's type.
+    if(!(nameiparent && *path == '\0') && ncget(ip, name, &next)){
+      iput(ip);
+      if(next == 0)
+        return 0;
+      ip = next;
+      continue;
+    }
     ilock(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
@@ -669,7 +1476,9 @@ namex(char *path, int nameiparent, char *name)
       iunlock(ip);
       return ip;
     }
-    if((next = dirlookup(ip, name, 0)) == 0){
+    next = dirlookup(ip, name, 0);
+    ncput(ip, name, next ? next->inum : 0);
+    if(next == 0){
       iunlockput(ip);
       return 0;
     }
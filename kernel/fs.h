@@ -24,9 +24,16 @@ struct superblock {
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
-#define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NIEXTENT 4     // extents kept in the inode itself
+#define MAXFILE 8192   // max file size, in blocks
+
+// Blocks lblk through lblk+len-1 of a file are stored in
+// consecutive disk blocks starting at start.
+struct extent {
+  uint lblk;
+  uint start;
+  uint len;
+};
 
 // On-disk inode structure
 struct dinode {
@@ -35,7 +42,23 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint extroot;         // Extent tree root block, or 0
+  struct extent ext[NIEXTENT];   // First extents of the file
+};
+
+// Extents per extent tree block.
+#define NEXTPB  ((BSIZE - 2*sizeof(uint)) / sizeof(struct extent))
+
+// A block of the extent tree, which maps the file's blocks past
+// those in the inode's own extents. A leaf (depth 0) holds
+// extents; an interior node's ext[i].start is the child that
+// maps blocks ext[i].lblk onward, and len is unused. Entries are
+// sorted by lblk. Files only grow at the end, so the tree only
+// grows along its rightmost path.
+struct extnode {
+  uint depth;
+  uint n;
+  struct extent ext[NEXTPB];
 };
 
 // Inodes per block.
@@ -58,3 +81,34 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// Directory entries per block.
+#define DPB           (BSIZE / sizeof(struct dirent))
+
+// An indexed directory's block 0 holds "." and "..", then a
+// header and an index of the leaf blocks that hold the rest of
+// its entries, by the hash of their names. The header and the
+// index are in dirent-sized slots whose inum is 0, so code that
+// scans the dirents skips them. A directory without the header
+// (from an older mkfs) is a plain array of dirents.
+#define DXMAGIC 0x78646976
+#define NDXENT  ((DPB - 3) * 2)  // index entries in block 0
+
+// Two index entries. Leaf blk[i] holds the names whose hash
+// is at least hash[i] and below the next entry's hash.
+struct dxslot {
+  ushort zero;       // overlays dirent.inum
+  ushort blk[2];     // leaf's block number in the directory
+  ushort pad;
+  uint hash[2];
+};
+
+struct dxroot {
+  struct dirent dot;
+  struct dirent dotdot;
+  ushort zero;       // overlays dirent.inum
+  ushort nent;       // index entries in use
+  uint magic;        // DXMAGIC
+  uint pad[2];
+  struct dxslot slot[NDXENT/2];
+};
+
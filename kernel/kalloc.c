@@ -1,6 +1,23 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// Each CPU has its own free list, so that kalloc() and kfree()
+// usually take a lock no other CPU is using. A CPU whose list
+// runs dry refills a batch of pages from a shared pool; a CPU
+// whose list grows long drains a batch back to the pool. If the
+// pool is empty too, kalloc() steals half of another CPU's list.
+//
+// Each page has a reference count, so that copy-on-write fork
+// can share a page among page tables; kfree() only frees a page
+// when its last reference is dropped.
+//
+// Whole, aligned 2-megabyte blocks of RAM start out on a separate
+// list of superpages, for ksuperalloc(). kalloc() splits one into
+// pages only when no CPU has a page to spare. A superpage holds
+// a reference on each of its pages, so a page table that breaks
+// a megapage mapping into pages can free them one at a time.
+// Pages freed one at a time are never put back together.
 
 #include "types.h"
 #include "param.h"
@@ -9,7 +26,11 @@
 #include "riscv.h"
 #include "defs.h"
 
+#define KBATCH  32          // pages moved to or from the pool at once
+#define KHIGH   (4*KBATCH)  // drain a CPU's list when it grows past this
+
 void freerange(void *pa_start, void *pa_end);
+static void kfreepage(void *pa);
 
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
@@ -18,15 +39,37 @@ struct run {
   struct run *next;
 };
 
+struct kmem {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+  int nrefill;   // batches taken from the pool
+  int ndrain;    // batches given back to the pool
+  int nsteal;    // times this CPU stole from another CPU
+};
+
+struct kmem kmem[NCPU];  // per-CPU free lists
+struct kmem kpool;       // shared pool
+
 struct {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  int nfree;
+  int nalloc;    // superpages handed out
+  int nsplit;    // superpages split into pages
+} ksuper;
+
+// Page reference counts, changed with atomic instructions.
+#define PA2REF(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+static int kref[(PHYSTOP - KERNBASE) / PGSIZE];
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kmem[i].lock, "kmem");
+  initlock(&kpool.lock, "kmem_pool");
+  initlock(&ksuper.lock, "kmem_super");
   freerange(end, (void*)PHYSTOP);
 }
 
@@ -34,32 +77,179 @@ void
 freerange(void *pa_start, void *pa_end)
 {
   char *p;
+  struct run *r;
+
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  while(p + PGSIZE <= (char*)pa_end){
+    if((uint64)p % SUPERPGSIZE == 0 && p + SUPERPGSIZE <= (char*)pa_end){
+      r = (struct run*)p;
+      r->next = ksuper.freelist;
+      ksuper.freelist = r;
+      ksuper.nfree++;
+      p += SUPERPGSIZE;
+    } else {
+      kref[PA2REF(p)] = 1;
+      kfree(p);
+      p += PGSIZE;
+    }
+  }
+}
+
+// Detach up to n pages from the front of km's list.
+// Returns the first page and sets *last to the last one.
+// Caller must hold km->lock.
+static struct run*
+takebatch(struct kmem *km, int n, struct run **last, int *got)
+{
+  struct run *first, *r;
+  int i;
+
+  first = km->freelist;
+  if(first == 0){
+    *got = 0;
+    return 0;
+  }
+  r = first;
+  for(i = 1; i < n && r->next; i++)
+    r = r->next;
+  km->freelist = r->next;
+  km->nfree -= i;
+  r->next = 0;
+  *last = r;
+  *got = i;
+  return first;
 }
 
-// Free the page of physical memory pointed at by pa,
-// which normally should have been returned by a
+// Drop a reference to the page of physical memory pointed
+// at by pa, which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// Frees the page if that was the last reference.
 void
 kfree(void *pa)
 {
-  struct run *r;
+  int n;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  if((n = __sync_sub_and_fetch(&kref[PA2REF(pa)], 1)) > 0)
+    return;
+  if(n < 0)
+    panic("kfree: ref");
+  kfreepage(pa);
+}
+
+// Put page pa, which no one refers to any more, on this
+// CPU's free list.
+static void
+kfreepage(void *pa)
+{
+  struct run *r, *first, *last;
+  struct kmem *km;
+  int n;
+
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  km = &kmem[cpuid()];
+  acquire(&km->lock);
+  r->next = km->freelist;
+  km->freelist = r;
+  km->nfree++;
+  first = 0;
+  n = 0;
+  if(km->nfree > KHIGH){
+    first = takebatch(km, KBATCH, &last, &n);
+    km->ndrain++;
+  }
+  release(&km->lock);
+
+  if(first){
+    acquire(&kpool.lock);
+    last->next = kpool.freelist;
+    kpool.freelist = first;
+    kpool.nfree += n;
+    release(&kpool.lock);
+  }
+  pop_off();
+}
+
+// Break a superpage into a list of free pages.
+// Returns the first page and sets *last to the last one,
+// or returns 0 if there are no superpages left.
+static struct run*
+ksplit(struct run **last)
+{
+  struct run *r;
+  char *p;
+
+  acquire(&ksuper.lock);
+  r = ksuper.freelist;
+  if(r){
+    ksuper.freelist = r->next;
+    ksuper.nfree--;
+    ksuper.nsplit++;
+  }
+  release(&ksuper.lock);
+  if(r == 0)
+    return 0;
+
+  for(p = (char*)r; p + PGSIZE < (char*)r + SUPERPGSIZE; p += PGSIZE)
+    ((struct run*)p)->next = (struct run*)(p + PGSIZE);
+  *last = (struct run*)p;
+  (*last)->next = 0;
+  return r;
+}
+
+// The current CPU's list is empty: take a batch from the
+// pool, or else steal half of another CPU's list, or else
+// split a superpage.
+// Returns one page and puts the rest on km's list.
+// Called with interrupts off and no kmem locks held,
+// so that two CPUs stealing from each other can't deadlock.
+static struct run*
+krefill(struct kmem *km)
+{
+  struct run *first, *last;
+  struct kmem *victim;
+  int n, stolen;
+
+  stolen = 0;
+  acquire(&kpool.lock);
+  first = takebatch(&kpool, KBATCH, &last, &n);
+  release(&kpool.lock);
+
+  for(victim = kmem; first == 0 && victim < &kmem[NCPU]; victim++){
+    if(victim == km)
+      continue;
+    acquire(&victim->lock);
+    first = takebatch(victim, (victim->nfree + 1) / 2, &last, &n);
+    release(&victim->lock);
+    stolen = 1;
+  }
+  if(first == 0){
+    if((first = ksplit(&last)) == 0)
+      return 0;
+    n = SUPERPGSIZE / PGSIZE;
+    stolen = 0;
+  }
+
+  acquire(&km->lock);
+  if(first != last){
+    last->next = km->freelist;
+    km->freelist = first->next;
+    km->nfree += n - 1;
+  }
+  if(stolen)
+    km->nsteal++;
+  else
+    km->nrefill++;
+  release(&km->lock);
+  return first;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -69,14 +259,132 @@ void *
 kalloc(void)
 {
   struct run *r;
+  struct kmem *km;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  push_off();
+  km = &kmem[cpuid()];
+  acquire(&km->lock);
+  r = km->freelist;
+  if(r){
+    km->freelist = r->next;
+    km->nfree--;
+  }
+  release(&km->lock);
+  if(r == 0)
+    r = krefill(km);
+  pop_off();
 
-  if(r)
+  if(r){
     memset((char*)r, 5, PGSIZE); // fill with junk
+    kref[PA2REF(r)] = 1;
+  }
   return (void*)r;
 }
+
+// Add a reference to page pa, which must be allocated.
+void
+kdup(void *pa)
+{
+  if(__sync_fetch_and_add(&kref[PA2REF(pa)], 1) < 1)
+    panic("kdup");
+}
+
+// Return the number of references to page pa.
+int
+krefs(void *pa)
+{
+  return __atomic_load_n(&kref[PA2REF(pa)], __ATOMIC_SEQ_CST);
+}
+
+// Allocate one aligned 2-megabyte superpage, with a reference
+// on each of its pages. Its contents are undefined.
+// Returns 0 if there are none left.
+void *
+ksuperalloc(void)
+{
+  struct run *r;
+  int i;
+
+  acquire(&ksuper.lock);
+  r = ksuper.freelist;
+  if(r){
+    ksuper.freelist = r->next;
+    ksuper.nfree--;
+    ksuper.nalloc++;
+  }
+  release(&ksuper.lock);
+
+  if(r){
+    for(i = 0; i < SUPERPGSIZE / PGSIZE; i++)
+      kref[PA2REF(r) + i] = 1;
+  }
+  return (void*)r;
+}
+
+// Drop a reference to each page of superpage pa. If that
+// frees them all, the superpage goes back on the superpage
+// list; otherwise the pages that were freed go to kfree()'s lists.
+void
+ksuperfree(void *pa)
+{
+  uint64 freed[SUPERPGSIZE / PGSIZE / 64];
+  struct run *r;
+  int i, n, all;
+
+  if(((uint64)pa % SUPERPGSIZE) != 0 || (char*)pa < end ||
+     (uint64)pa >= PHYSTOP)
+    panic("ksuperfree");
+
+  memset(freed, 0, sizeof(freed));
+  all = 1;
+  for(i = 0; i < SUPERPGSIZE / PGSIZE; i++){
+    if((n = __sync_sub_and_fetch(&kref[PA2REF(pa) + i], 1)) < 0)
+      panic("ksuperfree: ref");
+    if(n == 0)
+      freed[i / 64] |= 1L << (i % 64);
+    else
+      all = 0;
+  }
+
+  if(all){
+    r = (struct run*)pa;
+    acquire(&ksuper.lock);
+    r->next = ksuper.freelist;
+    ksuper.freelist = r;
+    ksuper.nfree++;
+    release(&ksuper.lock);
+    return;
+  }
+  for(i = 0; i < SUPERPGSIZE / PGSIZE; i++)
+    if(freed[i / 64] & (1L << (i % 64)))
+      kfreepage((char*)pa + i*PGSIZE);
+}
+
+// Add a reference to each page of superpage pa.
+void
+ksuperdup(void *pa)
+{
+  for(int i = 0; i < SUPERPGSIZE / PGSIZE; i++)
+    kdup((char*)pa + i*PGSIZE);
+}
+
+// Report allocator batching activity for the statistics device.
+int
+statskmem(char *buf, int sz)
+{
+  int n, nfree, nrefill, ndrain, nsteal;
+
+  nfree = kpool.nfree;
+  nrefill = ndrain = nsteal = 0;
+  for(int i = 0; i < NCPU; i++){
+    nfree += kmem[i].nfree;
+    nrefill += kmem[i].nrefill;
+    ndrain += kmem[i].ndrain;
+    nsteal += kmem[i].nsteal;
+  }
+  n = snprintf(buf, sz, "kmem: free %d pool %d refill %d drain %d steal %d\n",
+               nfree, kpool.nfree, nrefill, ndrain, nsteal);
+  n += snprintf(buf+n, sz-n, "kmem: superpages free %d allocated %d split %d\n",
+                ksuper.nfree, ksuper.nalloc, ksuper.nsplit);
+  return n;
+}
@@ -11,15 +11,26 @@
 //
 // A log transaction contains the updates of multiple FS system
 // calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
-// any reasoning required about whether a commit might
+// no FS system calls active in the transaction. Thus there is
+// never any reasoning required about whether a commit might
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
 // its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// the count of in-progress FS system calls, reserves room
+// in the log for MAXOPBLOCKS blocks, and returns. But if
+// the log is close to running out, it sleeps until the last
+// outstanding end_op() commits. A big write reserves room
+// for more blocks, up to BIGOPBLOCKS, with begin_opn() and
+// end_opn().
+//
+// Commits are double-buffered. The last end_op() of a
+// transaction copies the transaction's blocks into private
+// snapshot buffers, which takes only a moment; after that, new
+// system calls start the next transaction while the snapshot
+// is written to the log and installed. The committer then
+// commits the next transaction too, if it has finished
+// meanwhile, so one commit can carry many system calls.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -28,7 +39,18 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Log blocks are written in batches, and the header only
+// after all of them are on disk.
+//
+// With LAZYCKPT, committed blocks are not installed at their
+// home locations right away. Each commit appends to the log,
+// and the committed blocks stay pinned in the buffer cache.
+// A checkpoint installs the newest copy of each logged block
+// and empties the log. It happens when the next transaction
+// won't fit, or at a commit CKPTTICKS after the last one. A
+// block written by several transactions in between is only
+// installed once. Recovery replays the log in order, so
+// later copies of a block overwrite earlier ones.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -42,14 +64,37 @@ struct log {
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks they may yet write.
+  int committing;  // a commit is in progress.
+  int snapshotting; // copying the transaction, please wait.
   int dev;
-  struct logheader lh;
+  struct logheader lh;  // the transaction being built
+  struct buf *bufs[LOGSIZE]; // cache buffers for lh.block[]
+
+  // the transaction being committed.
+  struct logheader clh;
+  struct buf *cbufs[LOGSIZE];
+
+  // the committed but not yet installed part of the log, i.e.
+  // the on-disk header, indexed by log slot. only the
+  // committer uses these.
+  struct logheader dlh;
+  struct buf *dbufs[LOGSIZE];  // pinned cache buffers
+  struct buf snap[LOGSIZE];    // block contents
+  uint lastckpt;               // ticks at last checkpoint
+
+  // statistics
+  int ncommit;
+  int nblocks;     // blocks written by all commits
+  uint64 latency;  // total commit time, in timer cycles
+  int nckpt;       // checkpoints
+  int ninstall;    // blocks installed by checkpoints
 };
 struct log log;
 
 static void recover_from_log(void);
-static void commit();
+static void commit(void);
+static void write_head(void);
 
 void
 initlog(int dev, struct superblock *sb)
@@ -60,38 +105,63 @@ initlog(int dev, struct superblock *sb)
   initlock(&log.lock, "log");
   log.start = sb->logstart;
   log.size = sb->nlog;
+  if(log.size > LOGSIZE + 1)
+    log.size = LOGSIZE + 1;  // the header and LOGSIZE slots
   log.dev = dev;
   recover_from_log();
 }
 
-// Copy committed blocks from log to their home location
+// Write the bufs to disk, to the blocks their blockno
+// fields name, all at once.
+static void
+write_bufs(struct buf **bs, int n)
+{
+  virtio_disk_startv(bs, n, 1);
+  for (int i = 0; i < n; i++)
+    virtio_disk_wait(bs[i]);
+}
+
+// Copy the newest logged copy of each block to its home
+// location, and empty the log.
 static void
 install_trans(int recovering)
 {
-  int tail;
+  struct buf *bs[LOGSIZE];
+  int slot, i, n;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  n = 0;
+  for (slot = log.dlh.n - 1; slot >= 0; slot--) {
+    for (i = slot + 1; i < log.dlh.n; i++)
+      if (log.dlh.block[i] == log.dlh.block[slot])
+        break;
+    if (i < log.dlh.n)
+      continue;   // a later slot has a newer copy
+    log.snap[slot].blockno = log.dlh.block[slot];
+    bs[n++] = &log.snap[slot];
   }
+  write_bufs(bs, n);
+
+  if(recovering == 0){
+    for (slot = 0; slot < log.dlh.n; slot++)
+      bunpin(log.dbufs[slot]);
+  }
+  log.dlh.n = 0;
+  write_head(); // clear the log
+  log.lastckpt = uptime();
+  log.nckpt++;
+  log.ninstall += n;
 }
 
-// Read the log header from disk into the in-memory log header
+// Read the log header from disk into the in-memory header
 static void
 read_head(void)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  log.dlh.n = lh->n;
+  for (i = 0; i < log.dlh.n; i++) {
+    log.dlh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
@@ -105,9 +175,9 @@ write_head(void)
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = log.dlh.n;
+  for (i = 0; i < log.dlh.n; i++) {
+    hb->block[i] = log.dlh.block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -116,48 +186,78 @@ write_head(void)
 static void
 recover_from_log(void)
 {
+  int slot;
+
   read_head();
+  for (slot = 0; slot < log.dlh.n; slot++) {
+    struct buf *lbuf = bread(log.dev, log.start+slot+1); // read log block
+    memmove(log.snap[slot].data, lbuf->data, BSIZE);
+    brelse(lbuf);
+  }
   install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
 }
 
-// called at the start of each FS system call.
+// called at the start of each FS system call that
+// may write n blocks.
 void
-begin_op(void)
+begin_opn(int n)
 {
+  if(n > BIGOPBLOCKS)
+    panic("begin_opn");
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.snapshotting){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.reserved + n > LOGSIZE){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
       release(&log.lock);
       break;
     }
   }
 }
 
-// called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// called at the start of each FS system call.
 void
-end_op(void)
+begin_op(void)
+{
+  begin_opn(MAXOPBLOCKS);
+}
+
+// Hand the transaction being built to the committer.
+// Caller holds log.lock; no FS system calls are outstanding.
+static void
+start_commit(void)
+{
+  log.clh = log.lh;
+  memmove(log.cbufs, log.bufs, sizeof(log.bufs));
+  log.lh.n = 0;
+  log.snapshotting = 1;
+}
+
+// called at the end of each FS system call, with the n
+// that its begin_opn() reserved.
+// commits if this was the last outstanding operation,
+// unless a commit is already running; that commit will
+// pick this transaction up when it is done.
+void
+end_opn(int n)
 {
   int do_commit = 0;
 
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
+  log.reserved -= n;
+  if(log.outstanding == 0 && !log.committing && log.lh.n > 0){
     do_commit = 1;
     log.committing = 1;
+    start_commit();
   } else {
     // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
+    // and decrementing log.reserved has decreased
     // the amount of reserved space.
     wakeup(&log);
   }
@@ -167,38 +267,91 @@ end_op(void)
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
     commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// called at the end of each FS system call that
+// began with begin_op().
+void
+end_op(void)
+{
+  end_opn(MAXOPBLOCKS);
+}
+
+// Copy the committing transaction's blocks from the cache
+// into the log slots after the committed ones.
 static void
-write_log(void)
+snapshot(void)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  for (tail = 0; tail < log.clh.n; tail++) {
+    struct buf *b = log.cbufs[tail];
+    acquiresleep(&b->lock);
+    memmove(log.snap[log.dlh.n+tail].data, b->data, BSIZE);
+    releasesleep(&b->lock);
   }
 }
 
+// Write the snapshot to the log, and add it to the header.
 static void
-commit()
+write_log(void)
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
+  struct buf *bs[LOGSIZE];
+  int tail, slot;
+
+  for (tail = 0; tail < log.clh.n; tail++) {
+    slot = log.dlh.n + tail;
+    log.snap[slot].blockno = log.start+slot+1;
+    log.dlh.block[slot] = log.clh.block[tail];
+    log.dbufs[slot] = log.cbufs[tail];
+    bs[tail] = &log.snap[slot];
+  }
+  write_bufs(bs, log.clh.n);
+  log.dlh.n += log.clh.n;
+}
+
+// Commit log.clh, then any transaction that completed
+// while it was being written.
+static void
+commit(void)
+{
+  uint64 t0;
+
+  while(1){
+    t0 = r_time();
+    // make room in the log, if need be. slot i is the
+    // block after the header at log.start+i+1, so the log
+    // has room for log.size-1 slots.
+    if(log.dlh.n + log.clh.n > log.size - 1)
+      install_trans(0);
+    snapshot();
+
+    acquire(&log.lock);
+    log.snapshotting = 0;
+    wakeup(&log);
+    release(&log.lock);
+
+    write_log();     // Write the snapshot to the log
     write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    int n = log.clh.n;
+    log.clh.n = 0;
+    if(!LAZYCKPT || uptime() - log.lastckpt >= CKPTTICKS)
+      install_trans(0); // Install writes to home locations
+
+    acquire(&log.lock);
+    log.ncommit++;
+    log.nblocks += n;
+    log.latency += r_time() - t0;
+    if(log.outstanding == 0 && log.lh.n > 0){
+      start_commit();
+      release(&log.lock);
+      continue;
+    }
+    log.committing = 0;
+    wakeup(&log);
+    release(&log.lock);
+    break;
   }
 }
 
@@ -229,8 +382,31 @@ log_write(struct buf *b)
   log.lh.block[i] = b->blockno;
   if (i == log.lh.n) {  // Add new block to log?
     bpin(b);
+    log.bufs[i] = b;
     log.lh.n++;
   }
   release(&log.lock);
 }
 
+// Report commit batching for the statistics device.
+int
+statslog(char *buf, int sz)
+{
+  int n, ncommit, nblocks;
+  uint64 latency;
+
+  acquire(&log.lock);
+  ncommit = log.ncommit;
+  nblocks = log.nblocks;
+  latency = log.latency;
+  release(&log.lock);
+
+  if(ncommit == 0)
+    n = snprintf(buf, sz, "log: commits 0\n");
+  else
+    n = snprintf(buf, sz, "log: commits %d blocks/commit %d cycles/commit %l\n",
+                 ncommit, nblocks / ncommit, latency / ncommit);
+  n += snprintf(buf+n, sz-n, "log: checkpoints %d installed %d of %d\n",
+                log.nckpt, log.ninstall, nblocks);
+  return n;
+}
@@ -0,0 +1,388 @@
+//
+// Memory-mapped files and anonymous memory: mmap() and munmap().
+//
+// Each process has NVMA regions, placed downward from just
+// below the trapframe; the heap may not grow into them. mmap()
+// only records the region. A page is allocated, and read from
+// the file if there is one, by vmfault() when it is first
+// touched.
+//
+// Stores to a MAP_SHARED file mapping go to the file when the
+// region is unmapped, by munmap(), exec() or exit(): each page
+// the hardware marked dirty is written with writei() in a log
+// transaction of its own. Processes that map the same file
+// don't share pages, except between a parent and a child that
+// inherited the mapping.
+//
+// An anonymous MAP_HUGE region is aligned to, and a multiple
+// of, SUPERPGSIZE, and its first touch of each superpage maps
+// a whole superpage, if one is free, cutting TLB misses and
+// page-table pages for big allocations.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "stat.h"
+#include "file.h"
+#include "fcntl.h"
+#include "defs.h"
+
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+// Return the region of p holding va, or 0.
+struct vma*
+vmafind(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->addr && va >= v->addr && va < v->addr + v->len)
+      return v;
+  return 0;
+}
+
+// The lowest address of any of p's regions, or TRAPFRAME
+// if it has none. The heap must stay below this.
+uint64
+vmabase(struct proc *p)
+{
+  struct vma *v;
+  uint64 base;
+
+  base = TRAPFRAME;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->addr && v->addr < base)
+      base = v->addr;
+  return base;
+}
+
+// Find room for len bytes: the highest address below
+// TRAPFRAME that is a multiple of align, overlaps no region
+// and is above the heap. Returns 0 if there is no room.
+static uint64
+vmaplace(struct proc *p, uint64 len, uint64 align)
+{
+  struct vma *v;
+  uint64 a;
+  int i;
+
+  if(len > TRAPFRAME)
+    return 0;
+  a = (TRAPFRAME - len) & ~(align - 1);
+  for(i = 0; i < NVMA; i++){
+    v = &p->vma[i];
+    if(v->addr && a < v->addr + v->len && v->addr < a + len){
+      if(v->addr < len)
+        return 0;
+      a = (v->addr - len) & ~(align - 1);
+      i = -1;  // start over
+    }
+  }
+  if(a < PGROUNDUP(p->sz))
+    return 0;
+  return a;
+}
+
+static int
+vmaperm(struct vma *v)
+{
+  int perm = PTE_U;
+
+  if(v->prot & PROT_READ)
+    perm |= PTE_R;
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_R|PTE_W;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+  return perm;
+}
+
+// Map len bytes of f at offset off, or anonymous memory if
+// f is 0, into the current process.
+// Returns the address, or -1.
+uint64
+mmap(uint64 len, int prot, int flags, struct file *f, uint off)
+{
+  struct proc *p = myproc();
+  struct vma *v, *free;
+  uint64 a, align;
+
+  if(len == 0 || len > TRAPFRAME || off % PGSIZE != 0)
+    return -1;
+  if((flags & (MAP_SHARED|MAP_PRIVATE)) == 0 ||
+     (flags & (MAP_SHARED|MAP_PRIVATE)) == (MAP_SHARED|MAP_PRIVATE))
+    return -1;
+  if((flags & MAP_HUGE) && f)
+    return -1;
+  if(f){
+    if(f->type != FD_INODE || f->ip->type != T_FILE)
+      return -1;
+    if(!f->readable)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+  }
+
+  free = 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->addr == 0){
+      free = v;
+      break;
+    }
+  }
+  if(flags & MAP_HUGE){
+    len = SUPERPGROUNDUP(len);
+    align = SUPERPGSIZE;
+  } else {
+    len = PGROUNDUP(len);
+    align = PGSIZE;
+  }
+  if(len > TRAPFRAME)
+    return -1;
+  a = free ? vmaplace(p, len, align) : 0;
+  if(a == 0)
+    return -1;
+
+  free->addr = a;
+  free->len = len;
+  free->prot = prot;
+  free->flags = flags;
+  free->f = f ? filedup(f) : 0;
+  free->off = off;
+  return a;
+}
+
+// Read in, or allocate, the page holding va in region v of
+// p, for a load, or a store if write is set.
+// Returns 0 on success, -1 on failure.
+int
+vmafault(struct proc *p, struct vma *v, uint64 va, int write)
+{
+  struct inode *ip;
+  char *mem;
+  int perm, r;
+
+  perm = vmaperm(v);
+  if((perm & (PTE_R|PTE_X)) == 0 || (write && (perm & PTE_W) == 0))
+    return -1;
+
+  // Mark the page accessed, and dirty if it's being
+  // written, so the store needn't fault again to set them.
+  perm |= PTE_A;
+  if(write)
+    perm |= PTE_D;
+
+  if(v->flags & MAP_HUGE){
+    // p can't run until this returns, so it's safe to clear
+    // the superpage after mapping it, which fails if some of
+    // it is mapped already. Then, or if there are no free
+    // superpages, fall back to a page.
+    if((mem = ksuperalloc()) != 0){
+      if(mapsuper(p->pagetable, SUPERPGROUNDDOWN(va), (uint64)mem, perm) == 0){
+        memset(mem, 0, SUPERPGSIZE);
+        return 0;
+      }
+      ksuperfree(mem);
+    }
+  }
+
+  va = PGROUNDDOWN(va);
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(v->f){
+    // Reading may sleep; see vmprefault().
+    ip = v->f->ip;
+    if(intr_get() == 0 || holdingsleep(&ip->lock)){
+      kfree(mem);
+      return -1;
+    }
+    ilock(ip);
+    r = readi(ip, 0, (uint64)mem, v->off + (va - v->addr), PGSIZE);
+    iunlock(ip);
+    if(r < 0){
+      kfree(mem);
+      return -1;
+    }
+  }
+
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Write the dirty pages of v in [start, end) back to its
+// file, if it's a shared file mapping. Only the part of the
+// file that exists is written; mapping a file doesn't grow it.
+static void
+vmawriteback(struct proc *p, struct vma *v, uint64 start, uint64 end)
+{
+  struct inode *ip;
+  uint64 a;
+  uint off, n;
+  pte_t *pte;
+
+  if(v->f == 0 || (v->flags & MAP_SHARED) == 0)
+    return;
+  ip = v->f->ip;
+  for(a = start; a < end; a += PGSIZE){
+    pte = walk(p->pagetable, a, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_D) == 0)
+      continue;
+    off = v->off + (a - v->addr);
+    // A page is four whole blocks of a file that already
+    // has them, so it fits in one transaction.
+    begin_op();
+    ilock(ip);
+    if(off < ip->size){
+      n = min(PGSIZE, ip->size - off);
+      writei(ip, 0, PTE2PA(*pte), off, n);
+    }
+    iunlock(ip);
+    end_op();
+    *pte &= ~PTE_D;
+  }
+}
+
+// Write back and unmap [start, end) of region v,
+// which must cover it.
+static void
+vmaunmap(struct proc *p, struct vma *v, uint64 start, uint64 end)
+{
+  vmawriteback(p, v, start, end);
+  uvmunmap(p->pagetable, start, (end - start) / PGSIZE, 1);
+}
+
+// Unmap the len bytes at addr, which must be page-aligned,
+// or superpage-aligned in a MAP_HUGE region, from the
+// current process. The range may cover parts of
+// several regions; a region whose middle is unmapped becomes
+// two. Returns 0, or -1 if that needs more regions than a
+// process has.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v, *free;
+  uint64 end, s, e;
+
+  if(addr % PGSIZE != 0 || len == 0 || addr + len < addr)
+    return -1;
+  end = PGROUNDUP(addr + len);
+
+  // Splitting a region takes a free slot; make sure
+  // there is one before changing anything.
+  free = 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->addr == 0 && free == 0)
+      free = v;
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->addr == 0 || end <= v->addr || addr >= v->addr + v->len)
+      continue;
+    if(addr > v->addr && end < v->addr + v->len && free == 0)
+      return -1;
+    // superpages are unmapped whole.
+    if((v->flags & MAP_HUGE) &&
+       (addr % SUPERPGSIZE != 0 || end % SUPERPGSIZE != 0))
+      return -1;
+  }
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->addr == 0 || end <= v->addr || addr >= v->addr + v->len)
+      continue;
+    s = max(addr, v->addr);
+    e = min(end, v->addr + v->len);
+    vmaunmap(p, v, s, e);
+    if(s == v->addr && e == v->addr + v->len){
+      if(v->f)
+        fileclose(v->f);
+      v->addr = 0;
+    } else if(s == v->addr){
+      v->off += e - v->addr;
+      v->len -= e - v->addr;
+      v->addr = e;
+    } else if(e == v->addr + v->len){
+      v->len = s - v->addr;
+    } else {
+      *free = *v;
+      free->addr = e;
+      free->len = v->addr + v->len - e;
+      free->off = v->off + (e - v->addr);
+      if(free->f)
+        filedup(free->f);
+      v->len = s - v->addr;
+    }
+  }
+  return 0;
+}
+
+// Give child np copies of p's regions. Pages of shared
+// regions are shared; pages of private ones are copy-on-write.
+// Untouched pages of a shared anonymous region are allocated
+// first, so that parent and child get the same ones.
+// Returns 0 on success, -1 on failure, having unmapped any
+// pages it mapped in np.
+int
+vmafork(struct proc *p, struct proc *np)
+{
+  struct vma *v;
+  uint64 a;
+  int i;
+
+  for(i = 0; i < NVMA; i++){
+    v = &p->vma[i];
+    if(v->addr == 0)
+      continue;
+    if(v->f == 0 && (v->flags & MAP_SHARED)){
+      for(a = v->addr; a < v->addr + v->len; a += PGSIZE)
+        if(walkaddr(p->pagetable, a) == 0 && vmafault(p, v, a, 0) != 0)
+          goto err;
+    }
+    if(uvmshare(p->pagetable, np->pagetable, v->addr, v->addr + v->len,
+                (v->flags & MAP_PRIVATE) != 0) != 0)
+      goto err;
+    np->vma[i] = *v;
+    if(v->f)
+      filedup(v->f);
+  }
+  return 0;
+
+ err:
+  for(v = np->vma; v < &np->vma[NVMA]; v++){
+    if(v->addr){
+      uvmunmap(np->pagetable, v->addr, v->len / PGSIZE, 1);
+      if(v->f)
+        fileclose(v->f);
+      v->addr = 0;
+    }
+  }
+  if(i < NVMA && p->vma[i].addr)
+    uvmunmap(np->pagetable, p->vma[i].addr, p->vma[i].len / PGSIZE, 1);
+  return -1;
+}
+
+// Write back and unmap all of p's regions, as it exits
+// or execs.
+void
+vmaexit(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->addr == 0)
+      continue;
+    vmaunmap(p, v, v->addr, v->addr + v->len);
+    if(v->f)
+      fileclose(v->f);
+    v->addr = 0;
+  }
+}
@@ -1,13 +1,24 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
+#define TICKHZ       10  // clock ticks per second
+#define NPRIO         3  // scheduling priority levels
+#define BOOSTTICKS   50  // move every process to the top level this often
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
+#define PIPEPAGES     4  // pages of buffer per pipe; a power of two
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#define MAXOPBLOCKS  10  // max # of blocks most FS ops write
+#define LOGSIZE      (MAXOPBLOCKS*12)  // max data blocks in on-disk log
+#define BIGOPBLOCKS  (LOGSIZE/2)  // max # of blocks a big write's op writes
+#define LAZYCKPT      1  // install committed blocks lazily
+#define CKPTTICKS    30  // checkpoint at a commit this many ticks after the last
+#define RAMAX         8  // max blocks of sequential readahead
+#define NBUF         (LOGSIZE*2+MAXOPBLOCKS+RAMAX)  // size of disk block cache
+#define FSSIZE       20000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define NNCACHE      128   // name cache entries
+#define NTEXTPG      256   // program text pages cached for sharing
+#define NVMA         16    // mmap() regions per process
@@ -7,18 +7,39 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
 
-#define PIPESIZE 512
+#define PIPESIZE (PIPEPAGES*PGSIZE)
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data[PIPEPAGES];  // the buffer, a page at a time
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  struct pollwait *pollq;  // processes in poll()
 };
 
+static void
+pipefree(struct pipe *pi)
+{
+  for(int i = 0; i < PIPEPAGES; i++)
+    if(pi->data[i])
+      kfree(pi->data[i]);
+  kfree((char*)pi);
+}
+
+// Where byte off of the stream goes in the buffer, and how
+// much of the buffer from there on is contiguous.
+static char*
+pipebuf(struct pipe *pi, uint off, uint *n)
+{
+  off %= PIPESIZE;
+  *n = PGSIZE - off % PGSIZE;
+  return pi->data[off / PGSIZE] + off % PGSIZE;
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -30,6 +51,10 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((pi = (struct pipe*)kalloc()) == 0)
     goto bad;
+  memset(pi, 0, sizeof(*pi));
+  for(int i = 0; i < PIPEPAGES; i++)
+    if((pi->data[i] = kalloc()) == 0)
+      goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
@@ -47,7 +72,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    pipefree(pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -66,65 +91,126 @@ pipeclose(struct pipe *pi, int writable)
     pi->readopen = 0;
     wakeup(&pi->nwrite);
   }
+  pollwake(&pi->pollq);
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    freelock(&pi->lock);
+    pipefree(pi);
   } else
     release(&pi->lock);
 }
 
+// Each reader or writer woken by wakeone() passes the
+// wakeup on if there is data, or room, left for another,
+// however it then leaves pipewrite() or piperead().
+// Caller must hold pi->lock.
+static void
+pipepass(struct pipe *pi)
+{
+  if(pi->nread != pi->nwrite)
+    wakeone(&pi->nread);
+  if(pi->nwrite < pi->nread + PIPESIZE)
+    wakeone(&pi->nwrite);
+}
+
+// Copy as much of what's asked as fits, a contiguous
+// piece of the buffer at a time.
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, int user, uint64 addr, int n)
 {
   int i = 0;
+  uint m, room;
+  char *buf;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
   while(i < n){
     if(pi->readopen == 0 || killed(pr)){
+      pipepass(pi);
+      if(i > 0)
+        pollwake(&pi->pollq);
       release(&pi->lock);
       return -1;
     }
     if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
+      wakeone(&pi->nread);
+      pollwake(&pi->pollq);
       sleep(&pi->nwrite, &pi->lock);
     } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+      buf = pipebuf(pi, pi->nwrite, &m);
+      room = pi->nread + PIPESIZE - pi->nwrite;
+      if(m > room)
+        m = room;
+      if(m > n - i)
+        m = n - i;
+      if(either_copyin(buf, user, addr + i, m) == -1)
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      pi->nwrite += m;
+      i += m;
     }
   }
-  wakeup(&pi->nread);
+  pipepass(pi);
+  if(i > 0)
+    pollwake(&pi->pollq);
   release(&pi->lock);
 
   return i;
 }
 
 int
-piperead(struct pipe *pi, uint64 addr, int n)
+piperead(struct pipe *pi, int user, uint64 addr, int n)
 {
   int i;
+  uint m;
+  char *buf;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
     if(killed(pr)){
+      pipepass(pi);
       release(&pi->lock);
       return -1;
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  for(i = 0; i < n && pi->nread != pi->nwrite; i += m){  //DOC: piperead-copy
+    buf = pipebuf(pi, pi->nread, &m);
+    if(m > pi->nwrite - pi->nread)
+      m = pi->nwrite - pi->nread;
+    if(m > n - i)
+      m = n - i;
+    if(either_copyout(user, addr + i, buf, m) == -1)
       break;
+    pi->nread += m;
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  pipepass(pi);  //DOC: piperead-wakeup
+  if(i > 0)
+    pollwake(&pi->pollq);
   release(&pi->lock);
   return i;
 }
+
+// Which POLL* events hold for the read end of pi, or for
+// the write end if writable; see filepoll().
+int
+pipepoll(struct pipe *pi, int writable, struct pollwait *w)
+{
+  int r = 0;
+
+  acquire(&pi->lock);
+  polladd(&pi->pollq, &pi->lock, w);
+  if(writable){
+    if(pi->readopen == 0)
+      r |= POLLERR;
+    else if(pi->nwrite < pi->nread + PIPESIZE)
+      r |= POLLOUT;
+  } else {
+    if(pi->nread != pi->nwrite)
+      r |= POLLIN;
+    if(pi->writeopen == 0)
+      r |= POLLHUP;
+  }
+  release(&pi->lock);
+  return r;
+}
@@ -0,0 +1,158 @@
+//
+// poll(): wait until any of several files is ready.
+//
+// Each pipe, and the console, keeps a list of the pollers
+// waiting on it, under its own lock. A poller puts itself on
+// the list of every file it polls before it looks to see if
+// any is ready, so that a file that becomes ready after it
+// looked wakes it, by pollwake().
+//
+// A poller sleeps under its CPU's timer lock, the lock that
+// also covers a timeout, so that either can wake it. The lock
+// order is: the file's lock, then c->tlock.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "poll.h"
+#include "defs.h"
+
+// Join the list of pollers q, protected by lk, unless already
+// on it. Caller must hold lk.
+void
+polladd(struct pollwait **q, struct spinlock *lk, struct pollwait *w)
+{
+  if(w == 0 || w->q)
+    return;
+  w->lk = lk;
+  w->q = q;
+  w->next = *q;
+  *q = w;
+}
+
+// Wake the pollers on q. Caller must hold q's lock.
+void
+pollwake(struct pollwait **q)
+{
+  struct pollwait *w;
+
+  for(w = *q; w; w = w->next){
+    acquire(&w->pl->c->tlock);
+    w->pl->woken = 1;
+    wakeup(w->pl);
+    release(&w->pl->c->tlock);
+  }
+}
+
+static void
+polldel(struct pollwait *w)
+{
+  struct pollwait **pp;
+
+  if(w->q == 0)
+    return;
+  acquire(w->lk);
+  for(pp = w->q; *pp != w; pp = &(*pp)->next)
+    ;
+  *pp = w->next;
+  release(w->lk);
+  w->q = 0;
+}
+
+// Look at each of the n files in fds, joining their lists
+// of pollers, and fill in revents.
+// Returns the number with something to report.
+static int
+pollscan(struct pollfd *fds, int n, struct pollwait *w)
+{
+  struct proc *p = myproc();
+  struct file *f;
+  int i, r, nready;
+
+  nready = 0;
+  for(i = 0; i < n; i++){
+    fds[i].revents = 0;
+    if(fds[i].fd < 0)
+      continue;
+    if(fds[i].fd >= NOFILE || (f = p->ofile[fds[i].fd]) == 0){
+      fds[i].revents = POLLNVAL;
+      nready++;
+      continue;
+    }
+    r = filepoll(f, &w[i]);
+    fds[i].revents = r & (fds[i].events | POLLERR | POLLHUP);
+    if(fds[i].revents)
+      nready++;
+  }
+  return nready;
+}
+
+// Wait until one of the n files described by the pollfds at
+// user address addr is ready, or for timeout milliseconds if
+// that's not negative.
+// Returns the number of files ready, or -1.
+int
+poll(uint64 addr, int n, int timeout)
+{
+  struct proc *p = myproc();
+  struct pollfd fds[NOFILE];
+  struct pollwait w[NOFILE];
+  struct poller pl;
+  struct cpu *c;
+  uint64 when;
+  int i, nready, expired;
+
+  if(n < 0 || n > NOFILE)
+    return -1;
+  if(copyin(p->pagetable, (char*)fds, addr, n * sizeof(fds[0])) < 0)
+    return -1;
+
+  when = 0;
+  if(timeout > 0)
+    when = r_time() + (uint64)timeout * (TIMEBASE / 1000);
+  c = timeradd(when, &pl);
+  release(&c->tlock);
+  pl.c = c;
+  pl.woken = 0;
+  for(i = 0; i < n; i++){
+    w[i].pl = &pl;
+    w[i].q = 0;
+  }
+
+  for(;;){
+    nready = pollscan(fds, n, w);
+    if(nready || timeout == 0)
+      break;
+    acquire(&c->tlock);
+    while(!pl.woken && (when == 0 || p->tcpu) && !killed(p))
+      sleep(&pl, &c->tlock);
+    pl.woken = 0;
+    expired = when && p->tcpu == 0;
+    release(&c->tlock);
+    if(killed(p)){
+      nready = -1;
+      break;
+    }
+    if(expired){
+      nready = pollscan(fds, n, w);
+      break;
+    }
+  }
+
+  acquire(&c->tlock);
+  timerremove(p, c);
+  release(&c->tlock);
+  for(i = 0; i < n; i++)
+    polldel(&w[i]);
+
+  if(nready >= 0 && copyout(p->pagetable, addr, (char*)fds, n * sizeof(fds[0])) < 0)
+    return -1;
+  return nready;
+}
@@ -0,0 +1,11 @@
+#define POLLIN    0x001  // Data to read
+#define POLLOUT   0x004  // Room to write
+#define POLLERR   0x008  // Write end of a pipe with no reader
+#define POLLHUP   0x010  // Read end of a pipe with no writer
+#define POLLNVAL  0x020  // fd isn't open
+
+struct pollfd {
+  int fd;         // File descriptor; ignored if negative
+  short events;   // Events asked for
+  short revents;  // Events that happened
+};
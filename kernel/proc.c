@@ -12,11 +12,44 @@ struct proc proc[NPROC];
 
 struct proc *initproc;
 
+// Each CPU has run queues (c->rq): a FIFO of RUNNABLE processes
+// for each priority level. A process starts at level 0, and moves
+// down a level each time it uses up a time slice, which is
+// longer at lower levels. One that sleeps before its slice is
+// up, like a shell waiting for input, keeps its level, and so
+// runs ahead of compute-bound ones. Every BOOSTTICKS ticks all
+// processes move back up, so none starves.
+//
+// A process joins the queue of the CPU it last ran on, whose
+// caches may still hold its memory. A CPU with nothing queued
+// takes a process from the CPU with the most, or if there are
+// none, waits for an interrupt; queueing a process interrupts
+// an idle CPU that can run it.
+// Lock order: p->lock, then a c->rq.lock.
+static uint nboost;  // number of priority boosts so far
+static int nidle;    // CPUs in idle()
+
+// Sleeping processes wait on a queue chosen by hashing chan,
+// so wakeup() only looks at processes that may be sleeping
+// on chan, not all of proc[].
+// Lock order: the lock passed to sleep(), then a sleepq
+// lock, then p->lock.
+#define NSLEEPQ 61
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;   // in the order they went to sleep
+} sleepq[NSLEEPQ];
+
+#define SLEEPQ(chan) (&sleepq[((uint64)(chan) >> 3) % NSLEEPQ])
+
+#define QUANTUM(prio) (1 << (prio))  // ticks in a time slice
+
 int nextpid = 1;
 struct spinlock pid_lock;
 
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static void runnable(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
 
@@ -51,6 +84,10 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  for(int i = 0; i < NSLEEPQ; i++)
+    initlock(&sleepq[i].lock, "sleepq");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&cpus[i].rq.lock, "runq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->state = UNUSED;
@@ -124,6 +161,11 @@ allocproc(void)
 found:
   p->pid = allocpid();
   p->state = USED;
+  p->prio = 0;
+  p->slice = 0;
+  p->nice = 0;
+  p->boost = __atomic_load_n(&nboost, __ATOMIC_RELAXED);
+  p->cpu = cpuid();
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -162,6 +204,7 @@ freeproc(struct proc *p)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
   p->sz = 0;
+  p->nseg = 0;
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
@@ -249,12 +292,14 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  runnable(p);
 
   release(&p->lock);
 }
 
 // Grow or shrink user memory by n bytes.
+// Growing only moves p->sz; pages are allocated when first
+// touched, by vmfault().
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
@@ -264,9 +309,9 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    if(sz + n > vmabase(p))
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
@@ -295,6 +340,11 @@ fork(void)
     return -1;
   }
   np->sz = p->sz;
+  if(vmafork(p, np) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -307,9 +357,16 @@ fork(void)
     if(p->ofile[i])
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  if(p->exe)
+    np->exe = idup(p->exe);
+  memmove(np->seg, p->seg, sizeof(p->seg));
+  np->nseg = p->nseg;
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
+  np->nice = p->nice;
+  np->prio = p->nice;
+
   pid = np->pid;
 
   release(&np->lock);
@@ -319,7 +376,7 @@ fork(void)
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  runnable(np);
   release(&np->lock);
 
   return pid;
@@ -351,6 +408,9 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // Unmap mmap() regions, writing back shared ones.
+  vmaexit(p);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -362,8 +422,11 @@ exit(int status)
 
   begin_op();
   iput(p->cwd);
+  if(p->exe)
+    iput(p->exe);
   end_op();
   p->cwd = 0;
+  p->exe = 0;
 
   acquire(&wait_lock);
 
@@ -394,6 +457,10 @@ wait(uint64 addr)
   int havekids, pid;
   struct proc *p = myproc();
 
+  // The status is copied out with locks held.
+  if(addr != 0)
+    vmprefault(addr, sizeof(int));
+
   acquire(&wait_lock);
 
   for(;;){
@@ -434,10 +501,221 @@ wait(uint64 addr)
   }
 }
 
+// Bring p's level up to date with any priority boosts
+// since it last ran or was queued.
+// Caller must hold p->lock.
+static void
+catchup(struct proc *p)
+{
+  uint boost = __atomic_load_n(&nboost, __ATOMIC_RELAXED);
+
+  if(p->boost != boost){
+    p->boost = boost;
+    p->prio = p->nice;
+    p->slice = 0;
+  }
+}
+
+// Interrupt CPU c, waking it if it's idle.
+static void
+kick(struct cpu *c)
+{
+  *(uint32*)CLINT_MSIP(c - cpus) = 1;
+}
+
+// Mark p RUNNABLE and add it to the tail of its level's queue
+// on the CPU it last ran on. Wake that CPU if it's idle, or
+// else an idle CPU that can take p from it.
+// Caller must hold p->lock.
+static void
+runnable(struct proc *p)
+{
+  struct cpu *c;
+  struct runq *rq = &cpus[p->cpu].rq;
+
+  p->state = RUNNABLE;
+  catchup(p);
+  p->qnext = 0;
+  acquire(&rq->lock);
+  if(rq->tail[p->prio])
+    rq->tail[p->prio]->qnext = p;
+  else
+    rq->head[p->prio] = p;
+  rq->tail[p->prio] = p;
+  rq->n++;
+  release(&rq->lock);
+
+  // release() ordered the queueing before these loads;
+  // see idle().
+  if(__atomic_load_n(&cpus[p->cpu].idle, __ATOMIC_SEQ_CST)){
+    kick(&cpus[p->cpu]);
+  } else if(__atomic_load_n(&nidle, __ATOMIC_SEQ_CST) > 0){
+    for(c = cpus; c < &cpus[NCPU]; c++){
+      if(__atomic_load_n(&c->idle, __ATOMIC_SEQ_CST)){
+        kick(c);
+        break;
+      }
+    }
+  }
+}
+
+// Remove and return the process at the head of the
+// highest non-empty level of rq, or 0 if rq is empty.
+static struct proc*
+dequeue(struct runq *rq)
+{
+  struct proc *p;
+  int i;
+
+  p = 0;
+  acquire(&rq->lock);
+  for(i = 0; i < NPRIO; i++){
+    if((p = rq->head[i]) != 0){
+      if((rq->head[i] = p->qnext) == 0)
+        rq->tail[i] = 0;
+      rq->n--;
+      break;
+    }
+  }
+  release(&rq->lock);
+  return p;
+}
+
+// c has nothing to run: take a process from the CPU with
+// the most queued, or return 0 if no other CPU has any.
+static struct proc*
+steal(struct cpu *c)
+{
+  struct cpu *victim, *v;
+  struct proc *p;
+
+  for(;;){
+    // The counts are only a hint; dequeue() checks.
+    victim = 0;
+    for(v = cpus; v < &cpus[NCPU]; v++){
+      if(v != c && v->rq.n > 0 && (victim == 0 || v->rq.n > victim->rq.n))
+        victim = v;
+    }
+    if(victim == 0)
+      return 0;
+    if((p = dequeue(&victim->rq)) != 0){
+      c->nsteal++;
+      return p;
+    }
+  }
+}
+
+// Is any process queued on any CPU?
+static int
+queued(void)
+{
+  struct cpu *c;
+
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    if(__atomic_load_n(&c->rq.n, __ATOMIC_SEQ_CST) > 0)
+      return 1;
+  return 0;
+}
+
+// c has nothing to run: wait for an interrupt, instead of
+// spinning, counting the time spent idle. Interrupts stay off
+// from announcing that c is idle until wfi(), so that a kick()
+// in between isn't handled and forgotten before wfi() starts
+// waiting; wfi() returns for it regardless.
+static void
+idle(struct cpu *c)
+{
+  uint64 t0;
+
+  intr_off();
+  __atomic_store_n(&c->idle, 1, __ATOMIC_SEQ_CST);
+  __atomic_fetch_add(&nidle, 1, __ATOMIC_SEQ_CST);
+  // runnable() may have queued a process before it could
+  // see that c is idle.
+  if(!queued()){
+    t0 = r_time();
+    wfi();
+    c->idletime += r_time() - t0;
+  }
+  __atomic_fetch_sub(&nidle, 1, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&c->idle, 0, __ATOMIC_SEQ_CST);
+}
+
+// Is a process above level prio waiting to run on this CPU?
+// Caller must have interrupts off.
+static int
+waiting(int prio)
+{
+  struct runq *rq = &mycpu()->rq;
+  int i, r;
+
+  r = 0;
+  acquire(&rq->lock);
+  for(i = 0; i < prio; i++)
+    if(rq->head[i])
+      r = 1;
+  release(&rq->lock);
+  return r;
+}
+
+// Move every process to the top level. Called by timerintr()
+// every BOOSTTICKS ticks. Queued processes move now; the rest
+// catch up when they are next queued or charged a tick.
+void
+boost(void)
+{
+  struct runq *rq;
+  struct cpu *c;
+  int i;
+
+  __atomic_fetch_add(&nboost, 1, __ATOMIC_RELAXED);
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    rq = &c->rq;
+    acquire(&rq->lock);
+    for(i = 1; i < NPRIO; i++){
+      if(rq->head[i] == 0)
+        continue;
+      if(rq->tail[0])
+        rq->tail[0]->qnext = rq->head[i];
+      else
+        rq->head[0] = rq->head[i];
+      rq->tail[0] = rq->tail[i];
+      rq->head[i] = rq->tail[i] = 0;
+    }
+    release(&rq->lock);
+  }
+}
+
+// A timer interrupt arrived while the current process was
+// running: charge it a tick. Give up the CPU if that uses up
+// its time slice, moving it down a level, or if a process of
+// a higher level is waiting.
+void
+proctick(void)
+{
+  struct proc *p = myproc();
+  int y;
+
+  acquire(&p->lock);
+  catchup(p);
+  if(++p->slice >= QUANTUM(p->prio)){
+    if(p->prio < NPRIO-1)
+      p->prio++;
+    p->slice = 0;
+    y = 1;
+  } else {
+    y = waiting(p->prio);
+  }
+  release(&p->lock);
+  if(y)
+    yield();
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - take the process at the front of this CPU's run
+//    queues, or else one from another CPU's.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -452,22 +730,32 @@ scheduler(void)
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&p->lock);
+    if((p = dequeue(&c->rq)) == 0 && (p = steal(c)) == 0){
+      idle(c);
+      continue;
     }
+
+    // Waits until the CPU that queued p has switched away
+    // from it, if it was p itself.
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler: not runnable");
+
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    catchup(p);
+    p->state = RUNNING;
+    p->cpu = c - cpus;
+    c->proc = p;
+    c->nrun++;
+    timerstart();
+    swtch(&c->context, &p->context);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -504,7 +792,7 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  runnable(p);
   sched();
   release(&p->lock);
 }
@@ -536,47 +824,95 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct sleepq *sq = SLEEPQ(chan);
+  struct proc **pp;
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once p is on chan's sleep queue, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks the queue, and then p->lock),
   // so it's okay to release lk.
 
+  acquire(&sq->lock);
   acquire(&p->lock);  //DOC: sleeplock1
   release(lk);
 
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  for(pp = &sq->head; *pp; pp = &(*pp)->snext)
+    ;
+  *pp = p;
+  p->snext = 0;
+  p->sq = sq;
+  release(&sq->lock);
 
   sched();
 
   // Tidy up.
   p->chan = 0;
+  release(&p->lock);
+
+  // wakeup() took p off the queue, unless kill() woke it.
+  acquire(&sq->lock);
+  if(p->sq){
+    for(pp = &sq->head; *pp != p; pp = &(*pp)->snext)
+      ;
+    *pp = p->snext;
+    p->sq = 0;
+  }
+  release(&sq->lock);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
-// Wake up all processes sleeping on chan.
+// Wake up processes sleeping on chan: all of them, or if
+// one is set, just the one that has slept longest.
 // Must be called without any p->lock.
-void
-wakeup(void *chan)
+static void
+wake(void *chan, int one)
 {
-  struct proc *p;
+  struct sleepq *sq = SLEEPQ(chan);
+  struct proc *p, **pp;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
-      acquire(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
-      }
+  acquire(&sq->lock);
+  for(pp = &sq->head; (p = *pp) != 0; ){
+    acquire(&p->lock);
+    if(p->state == SLEEPING && p->chan == chan){
+      runnable(p);
+      *pp = p->snext;
+      p->sq = 0;
+      release(&p->lock);
+      if(one)
+        break;
+    } else {
       release(&p->lock);
+      pp = &p->snext;
     }
   }
+  release(&sq->lock);
+}
+
+// Wake up all processes sleeping on chan.
+// Must be called without any p->lock.
+void
+wakeup(void *chan)
+{
+  wake(chan, 0);
+}
+
+// Wake up one process sleeping on chan, for when only one
+// of them could go on, such as the next holder of a lock.
+// The one woken must wake another if there is more to do,
+// on every way out, including giving up because it was
+// killed.
+// Must be called without any p->lock.
+void
+wakeone(void *chan)
+{
+  wake(chan, 1);
 }
 
 // Kill the process with the given pid.
@@ -593,7 +929,7 @@ kill(int pid)
       p->killed = 1;
       if(p->state == SLEEPING){
         // Wake process from sleep().
-        p->state = RUNNABLE;
+        runnable(p);
       }
       release(&p->lock);
       return 0;
@@ -603,6 +939,28 @@ kill(int pid)
   return -1;
 }
 
+// Change the current process's nice value by incr, keeping
+// it between 0 and NPRIO-1; a higher value means a lower
+// priority. Returns the new value.
+int
+nice(int incr)
+{
+  struct proc *p = myproc();
+  int n;
+
+  acquire(&p->lock);
+  n = p->nice + incr;
+  if(n < 0)
+    n = 0;
+  if(n > NPRIO-1)
+    n = NPRIO-1;
+  p->nice = n;
+  if(p->prio < n)
+    p->prio = n;
+  release(&p->lock);
+  return n;
+}
+
 void
 setkilled(struct proc *p)
 {
@@ -677,7 +1035,25 @@ procdump(void)
       state = states[p->state];
     else
       state = "???";
-    printf("%d %s %s", p->pid, state, p->name);
+    printf("%d %s %d %s", p->pid, state, p->prio, p->name);
     printf("\n");
   }
 }
+
+// Report each CPU's scheduling for the statistics device.
+int
+statssched(char *buf, int sz)
+{
+  struct cpu *c;
+  int n;
+
+  n = 0;
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if(c->nrun == 0 && c->idletime == 0)
+      continue;
+    n += snprintf(buf+n, sz-n, "sched: cpu %d runs %d steals %d queued %d idle %d ms\n",
+                  (int)(c - cpus), c->nrun, c->nsteal, c->rq.n,
+                  (int)(c->idletime / (TIMEBASE / 1000)));
+  }
+  return n;
+}
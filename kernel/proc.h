@@ -18,12 +18,31 @@ struct context {
   uint64 s11;
 };
 
+// A CPU's run queues: a FIFO of RUNNABLE processes
+// for each priority level.
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NPRIO];
+  struct proc *tail[NPRIO];
+  int n;                      // Processes queued
+};
+
 // Per-CPU state.
 struct cpu {
   struct proc *proc;          // The process running on this cpu, or null.
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  struct runq rq;             // Processes waiting to run here
+  int nrun;                   // Processes switched to
+  int nsteal;                 // Processes taken from other CPUs' queues
+  int idle;                   // Waiting in idle() for an interrupt
+  uint64 idletime;            // CLINT_MTIME cycles spent idle
+  struct spinlock tlock;      // Protects timers
+  struct proc *timers;        // Processes in nsleep(), soonest first
+  uint64 twake;               // When the first of them is due
+  uint64 nexttick;            // When the running process is next ticked, or 0
+  int ntimer;                 // Timer interrupts
 };
 
 extern struct cpu cpus[NCPU];
@@ -81,6 +100,29 @@ struct trapframe {
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// An ELF segment of the running program. exec() doesn't load
+// it; each page is read from p->exe when it is first touched.
+struct vmseg {
+  uint64 va;     // first address; page-aligned
+  uint64 end;    // va + size in memory
+  uint off;      // offset of the segment in the file
+  uint filesz;   // bytes from the file; the rest is zero
+  int perm;      // PTE_X and PTE_W
+};
+
+#define NVMSEG 4  // max loadable segments in a program
+
+// A region of memory mapped by mmap(). Pages are allocated, or
+// read from the file, when first touched.
+struct vma {
+  uint64 addr;     // page-aligned; 0 if the slot is free
+  uint64 len;      // a multiple of PGSIZE
+  int prot;        // PROT_ bits
+  int flags;       // MAP_ bits
+  struct file *f;  // mapped file, or 0 if anonymous
+  uint off;        // offset in f of addr
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -91,6 +133,22 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int prio;                    // Scheduling level; 0 runs first
+  int slice;                   // Ticks used at this level
+  int nice;                    // Level a priority boost moves p to
+  uint boost;                  // Boosts p's prio has caught up with
+  int cpu;                     // CPU p last ran on; p queues there
+  struct proc *qnext;          // Next on its run queue
+
+  // p's sleep queue's lock must be held when using these:
+  struct sleepq *sq;           // Sleep queue p is on, or 0
+  struct proc *snext;          // Next on it
+
+  // p->tcpu->tlock must be held when using these:
+  uint64 twake;                // When p's timer is due
+  void *tchan;                 // What to wake p on then
+  struct proc *tnext;          // Next on tcpu->timers
+  struct cpu *tcpu;            // CPU whose timers p is on, or 0
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
@@ -103,5 +161,9 @@ struct proc {
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct inode *exe;           // Program file the segments page in from
+  struct vmseg seg[NVMSEG];    // Program segments
+  int nseg;
+  struct vma vma[NVMA];        // mmap() regions
   char name[16];               // Process name (debugging)
 };
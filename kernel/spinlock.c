@@ -8,12 +8,55 @@
 #include "proc.h"
 #include "defs.h"
 
+// Every initialized lock is recorded here so that
+// statslock() can report contention.
+#define NLOCK 1000
+
+static struct spinlock *locks[NLOCK];
+static struct spinlock lock_locks;
+
+// Remember lk in locks[]. If the table is full,
+// lk simply goes unreported.
+static void
+findslot(struct spinlock *lk)
+{
+  acquire(&lock_locks);
+  for(int i = 0; i < NLOCK; i++){
+    if(locks[i] == 0){
+      locks[i] = lk;
+      break;
+    }
+  }
+  release(&lock_locks);
+}
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
   lk->locked = 0;
   lk->cpu = 0;
+  lk->nts = 0;
+  lk->n = 0;
+  if(lk != &lock_locks){
+    if(lock_locks.name == 0)
+      initlock(&lock_locks, "lock_locks");
+    findslot(lk);
+  }
+}
+
+// Forget a lock whose memory is about to be freed.
+void
+freelock(struct spinlock *lk)
+{
+  acquire(&lock_locks);
+  for(int i = 0; i < NLOCK; i++){
+    if(locks[i] == lk){
+      locks[i] = 0;
+      break;
+    }
+  }
+  release(&lock_locks);
 }
 
 // Acquire the lock.
@@ -29,8 +72,9 @@ acquire(struct spinlock *lk)
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
+  __sync_fetch_and_add(&lk->n, 1);
   while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+    __sync_fetch_and_add(&lk->nts, 1);
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -108,3 +152,57 @@ pop_off(void)
   if(c->noff == 0 && c->intena)
     intr_on();
 }
+
+static int
+snprint_lock(char *buf, int sz, struct spinlock *lk)
+{
+  if(lk->n == 0)
+    return 0;
+  return snprintf(buf, sz, "lock: %s: #test-and-set %d #acquire() %d\n",
+                  lk->name, lk->nts, lk->n);
+}
+
+// Report the kmem and bcache locks, and the five
+// most contended locks, for the statistics device.
+int
+statslock(char *buf, int sz)
+{
+  int n, tot;
+  struct spinlock *top, *prev;
+
+  acquire(&lock_locks);
+  tot = 0;
+  n = snprintf(buf, sz, "--- lock kmem/bcache stats\n");
+  for(int i = 0; i < NLOCK; i++){
+    if(locks[i] == 0)
+      continue;
+    if(strncmp(locks[i]->name, "bcache", strlen("bcache")) == 0 ||
+       strncmp(locks[i]->name, "kmem", strlen("kmem")) == 0){
+      tot += locks[i]->nts;
+      n += snprint_lock(buf+n, sz-n, locks[i]);
+    }
+  }
+
+  n += snprintf(buf+n, sz-n, "--- top 5 contended locks:\n");
+  prev = 0;
+  for(int t = 0; t < 5; t++){
+    // the most contended lock that ranks below prev.
+    top = 0;
+    for(int i = 0; i < NLOCK; i++){
+      struct spinlock *lk = locks[i];
+      if(lk == 0 || lk == prev)
+        continue;
+      if(prev && (lk->nts > prev->nts || (lk->nts == prev->nts && lk > prev)))
+        continue;
+      if(top == 0 || lk->nts > top->nts || (lk->nts == top->nts && lk > top))
+        top = lk;
+    }
+    if(top == 0)
+      break;
+    n += snprint_lock(buf+n, sz-n, top);
+    prev = top;
+  }
+  n += snprintf(buf+n, sz-n, "tot= %d\n", tot);
+  release(&lock_locks);
+  return n;
+}
@@ -5,5 +5,9 @@ struct spinlock {
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // For contention statistics:
+  int nts;           // Number of failed test-and-set attempts.
+  int n;             // Number of acquire() calls.
 };
 
@@ -0,0 +1,101 @@
+//
+// formatted output to a buffer -- snprintf.
+//
+
+#include <stdarg.h>
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "riscv.h"
+#include "defs.h"
+
+static char digits[] = "0123456789abcdef";
+
+// Append c to buf if there is room; returns the new offset.
+static int
+sputc(char *buf, int sz, int off, char c)
+{
+  if(off < sz)
+    buf[off++] = c;
+  return off;
+}
+
+static int
+sprintint(char *buf, int sz, int off, uint64 x, int base, int neg)
+{
+  char tmp[24];
+  int i;
+
+  i = 0;
+  do {
+    tmp[i++] = digits[x % base];
+  } while((x /= base) != 0);
+
+  if(neg)
+    tmp[i++] = '-';
+
+  while(--i >= 0)
+    off = sputc(buf, sz, off, tmp[i]);
+  return off;
+}
+
+// Print to buf, which has room for sz bytes. Only understands
+// %d, %x, %l (unsigned 64-bit decimal), and %s. The output is not
+// NUL-terminated; returns the number of bytes stored.
+int
+snprintf(char *buf, int sz, char *fmt, ...)
+{
+  va_list ap;
+  int i, c, d, off;
+  char *s;
+
+  if(fmt == 0)
+    panic("null fmt");
+
+  off = 0;
+  va_start(ap, fmt);
+  for(i = 0; off < sz && (c = fmt[i] & 0xff) != 0; i++){
+    if(c != '%'){
+      off = sputc(buf, sz, off, c);
+      continue;
+    }
+    c = fmt[++i] & 0xff;
+    if(c == 0)
+      break;
+    switch(c){
+    case 'd':
+      d = va_arg(ap, int);
+      if(d < 0)
+        off = sprintint(buf, sz, off, -(uint64)d, 10, 1);
+      else
+        off = sprintint(buf, sz, off, d, 10, 0);
+      break;
+    case 'x':
+      off = sprintint(buf, sz, off, va_arg(ap, uint), 16, 0);
+      break;
+    case 'l':
+      off = sprintint(buf, sz, off, va_arg(ap, uint64), 10, 0);
+      break;
+    case 's':
+      if((s = va_arg(ap, char*)) == 0)
+        s = "(null)";
+      for(; *s; s++)
+        off = sputc(buf, sz, off, *s);
+      break;
+    case '%':
+      off = sputc(buf, sz, off, '%');
+      break;
+    default:
+      // Print unknown % sequence to draw attention.
+      off = sputc(buf, sz, off, '%');
+      off = sputc(buf, sz, off, c);
+      break;
+    }
+  }
+  va_end(ap);
+  return off;
+}
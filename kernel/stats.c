@@ -0,0 +1,87 @@
+//
+// The statistics device. Reading /statistics returns a text
+// report of kernel counters: lock contention, allocator
+// batching, and so on. The report is generated when a read
+// finds no report in progress, and handed out across successive
+// reads; a read past its end returns 0 and discards it.
+//
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define BUFSZ 4096
+static struct {
+  struct spinlock lock;
+  char buf[BUFSZ];
+  int sz;
+  int off;
+} stats;
+
+// Collect every subsystem's counters into buf.
+static int
+statsfill(char *buf, int sz)
+{
+  int n = 0;
+
+  n += statslock(buf+n, sz-n);
+  n += statskmem(buf+n, sz-n);
+  n += statsvm(buf+n, sz-n);
+  n += statssched(buf+n, sz-n);
+  n += statstimer(buf+n, sz-n);
+  n += statsexec(buf+n, sz-n);
+  n += statsbcache(buf+n, sz-n);
+  n += statslog(buf+n, sz-n);
+  n += statsfs(buf+n, sz-n);
+  n += statsncache(buf+n, sz-n);
+  return n;
+}
+
+int
+statswrite(int user_src, uint64 src, int n)
+{
+  return -1;
+}
+
+int
+statsread(int user_dst, uint64 dst, int n)
+{
+  int m;
+
+  acquire(&stats.lock);
+
+  if(stats.sz == 0){
+    stats.sz = statsfill(stats.buf, BUFSZ);
+    stats.off = 0;
+  }
+  m = stats.sz - stats.off;
+
+  if(m > 0){
+    if(m > n)
+      m = n;
+    if(either_copyout(user_dst, dst, stats.buf+stats.off, m) == -1)
+      m = -1;
+    else
+      stats.off += m;
+  } else {
+    m = 0;
+    stats.sz = 0;
+    stats.off = 0;
+  }
+  release(&stats.lock);
+  return m;
+}
+
+void
+statsinit(void)
+{
+  initlock(&stats.lock, "stats");
+
+  devsw[STATS].read = statsread;
+  devsw[STATS].write = statswrite;
+}
@@ -20,3 +20,13 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_mmap   22
+#define SYS_munmap 23
+#define SYS_nice   24
+#define SYS_nanosleep 25
+#define SYS_splice 26
+#define SYS_poll   27
+#define SYS_readv  28
+#define SYS_writev 29
+#define SYS_pread  30
+#define SYS_pwrite 31
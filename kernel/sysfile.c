@@ -15,6 +15,7 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "uio.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -76,7 +77,7 @@ sys_read(void)
   argint(2, &n);
   if(argfd(0, 0, &f) < 0)
     return -1;
-  return fileread(f, p, n);
+  return fileread(f, 1, p, n);
 }
 
 uint64
@@ -91,7 +92,125 @@ sys_write(void)
   if(argfd(0, 0, &f) < 0)
     return -1;
 
-  return filewrite(f, p, n);
+  return filewrite(f, 1, p, n);
+}
+
+// move data from one file to another, where each is a
+// pipe or a file, without passing it through user space.
+uint64
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  argint(2, &n);
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0)
+    return -1;
+  return filesplice(in, out, n);
+}
+
+// wait for any of several files to be ready.
+uint64
+sys_poll(void)
+{
+  uint64 fds;
+  int n, timeout;
+
+  argaddr(0, &fds);
+  argint(1, &n);
+  argint(2, &timeout);
+  return poll(fds, n, timeout);
+}
+
+// Fetch the iovec array that system call arguments n and n+1
+// describe, checking that the buffers total at most an int.
+// Returns the number of buffers, or -1.
+static int
+argiov(int n, struct iovec *iov)
+{
+  uint64 addr, total;
+  int niov;
+
+  argaddr(n, &addr);
+  argint(n+1, &niov);
+  if(niov < 0 || niov > IOV_MAX)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, addr, niov * sizeof(iov[0])) < 0)
+    return -1;
+  total = 0;
+  for(int i = 0; i < niov; i++){
+    if(iov[i].iov_len > 0x7fffffff)
+      return -1;
+    total += iov[i].iov_len;
+  }
+  if(total > 0x7fffffff)
+    return -1;
+  return niov;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int niov;
+
+  if((niov = argiov(1, iov)) < 0 || argfd(0, 0, &f) < 0)
+    return -1;
+  return filereadv(f, iov, niov, 0);
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int niov;
+
+  if((niov = argiov(1, iov)) < 0 || argfd(0, 0, &f) < 0)
+    return -1;
+  return filewritev(f, iov, niov, 0);
+}
+
+// read at an offset, leaving the file's own offset alone.
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  uint uoff;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || n < 0 || off < 0)
+    return -1;
+  iov.iov_base = (void*)p;
+  iov.iov_len = n;
+  uoff = off;
+  return filereadv(f, &iov, 1, &uoff);
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  uint uoff;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || n < 0 || off < 0)
+    return -1;
+  iov.iov_base = (void*)p;
+  iov.iov_len = n;
+  uoff = off;
+  return filewritev(f, &iov, 1, &uoff);
 }
 
 uint64
@@ -153,6 +272,7 @@ sys_link(void)
     iunlockput(dp);
     goto bad;
   }
+  ncinval(dp, name);
   iunlockput(dp);
   iput(ip);
 
@@ -222,6 +342,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  ncinval(dp, name);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -281,6 +402,7 @@ create(char *path, short type, short major, short minor)
 
   if(dirlink(dp, name, ip->inum) < 0)
     goto fail;
+  ncinval(dp, name);
 
   if(type == T_DIR){
     // now that success is guaranteed:
@@ -503,3 +625,34 @@ sys_pipe(void)
   }
   return 0;
 }
+
+// Map a file, or anonymous memory, into the address space.
+// The address hint is ignored; the kernel picks the address.
+uint64
+sys_mmap(void)
+{
+  uint64 len;
+  int prot, flags, off;
+  struct file *f;
+
+  argaddr(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argint(5, &off);
+  if(off < 0)
+    return -1;
+  f = 0;
+  if((flags & MAP_ANONYMOUS) == 0 && argfd(4, 0, &f) < 0)
+    return -1;
+  return mmap(len, prot, flags, f, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  return munmap(addr, len);
+}
@@ -52,20 +52,21 @@ uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   argint(0, &n);
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(killed(myproc())){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  if(n < 0)
+    n = 0;
+  return nsleep((uint64)n * (1000000000L / TICKHZ));
+}
+
+// sleep for a number of nanoseconds.
+uint64
+sys_nanosleep(void)
+{
+  uint64 ns;
+
+  argaddr(0, &ns);
+  return nsleep(ns);
 }
 
 uint64
@@ -77,15 +78,20 @@ sys_kill(void)
   return kill(pid);
 }
 
-// return how many clock tick interrupts have occurred
+// return how many clock ticks have passed
 // since start.
 uint64
 sys_uptime(void)
 {
-  uint xticks;
+  return uptime();
+}
+
+// lower (or raise) the caller's scheduling priority.
+uint64
+sys_nice(void)
+{
+  int incr;
 
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
-  return xticks;
+  argint(0, &incr);
+  return nice(incr);
 }
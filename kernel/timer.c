@@ -0,0 +1,207 @@
+//
+// Timers. There is no periodic clock interrupt: each CPU
+// programs its CLINT_MTIMECMP for the next thing it has to
+// do, if anything, so an idle CPU isn't woken just to count.
+//
+// A CPU running a process interrupts itself every TICK cycles,
+// so that proctick() can charge it for the time and preempt it.
+// A process that sleeps for a while, by nsleep() or poll() with
+// a timeout, joins a list of sleepers on the CPU it called from,
+// kept in order of when they are due, and that CPU's timer goes
+// off when the first one is due; the sleep can end between ticks.
+//
+// Each CPU's list and its lock are in struct cpu. Only the CPU
+// itself adds to the list, programs its timer, or reads the
+// time it is set for, c->twake, with interrupts off; a sleeper
+// that wakes early, because it was killed, takes itself off
+// the list from whichever CPU it is then on.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define TICK (TIMEBASE / TICKHZ)  // CLINT_MTIME cycles per tick
+#define NEVER (~0UL)
+
+static uint64 nextboost;  // time of the next priority boost
+
+void
+clockinit(void)
+{
+  for(int i = 0; i < NCPU; i++){
+    initlock(&cpus[i].tlock, "timer");
+    cpus[i].twake = NEVER;
+  }
+  nextboost = BOOSTTICKS * TICK;
+}
+
+// Clock ticks since boot.
+uint
+uptime(void)
+{
+  return r_time() / TICK;
+}
+
+// Set this CPU's timer for the earlier of its first sleeper's
+// deadline and its next tick, if it has a process to tick.
+// Caller must have interrupts off.
+static void
+settimer(struct cpu *c)
+{
+  uint64 when;
+
+  when = c->twake;
+  if(c->nexttick && c->nexttick < when)
+    when = c->nexttick;
+  *(uint64*)CLINT_MTIMECMP(c - cpus) = when;
+}
+
+// This CPU is about to run a process: tick every TICK
+// cycles until it stops running processes.
+// Caller must have interrupts off.
+void
+timerstart(void)
+{
+  struct cpu *c = mycpu();
+
+  if(c->nexttick == 0){
+    c->nexttick = r_time() + TICK;
+    settimer(c);
+  }
+}
+
+// This CPU's timer went off: wake the sleepers that are due,
+// and set the timer again.
+// Returns 2 if it is time for a tick of the running process,
+// 1 otherwise, as for devintr().
+int
+timerintr(void)
+{
+  struct cpu *c = mycpu();
+  struct proc *p;
+  uint64 now, boostat;
+  int tick;
+
+  c->ntimer++;
+  now = r_time();
+  acquire(&c->tlock);
+  while((p = c->timers) != 0 && p->twake <= now){
+    c->timers = p->tnext;
+    p->tcpu = 0;
+    wakeup(p->tchan);
+  }
+  c->twake = c->timers ? c->timers->twake : NEVER;
+  release(&c->tlock);
+
+  tick = 0;
+  if(c->nexttick && now >= c->nexttick){
+    if(c->proc){
+      c->nexttick = now + TICK;
+      tick = 1;
+    } else {
+      c->nexttick = 0;   // idle; stop ticking
+    }
+  }
+  settimer(c);
+
+  // Boosts happen on time while any CPU is busy, and
+  // don't matter while none is.
+  boostat = nextboost;
+  if(tick && now >= boostat &&
+     __sync_bool_compare_and_swap(&nextboost, boostat, now + BOOSTTICKS*TICK))
+    boost();
+  return tick ? 2 : 1;
+}
+
+// Take p off the list of sleepers it is on, if any.
+// Caller must hold c->tlock.
+void
+timerremove(struct proc *p, struct cpu *c)
+{
+  struct proc **pp;
+
+  if(p->tcpu != c)
+    return;
+  for(pp = &c->timers; *pp != p; pp = &(*pp)->tnext)
+    ;
+  *pp = p->tnext;
+  p->tcpu = 0;
+}
+
+// Arrange for the current process to be woken on chan at
+// time when, unless when is 0. Returns the CPU whose timer
+// will do it, with its tlock held; the process is off the
+// list, and p->tcpu is 0, once the time has come.
+struct cpu*
+timeradd(uint64 when, void *chan)
+{
+  struct proc *p = myproc();
+  struct proc **pp;
+  struct cpu *c;
+
+  // Holding c->tlock keeps interrupts off, and so keeps
+  // this process on c, while it sets c's timer.
+  push_off();
+  c = mycpu();
+  acquire(&c->tlock);
+  pop_off();
+  if(when == 0)
+    return c;
+  p->twake = when;
+  p->tchan = chan;
+  p->tcpu = c;
+  for(pp = &c->timers; *pp && (*pp)->twake <= when; pp = &(*pp)->tnext)
+    ;
+  p->tnext = *pp;
+  *pp = p;
+  if(c->timers == p){
+    c->twake = when;
+    settimer(c);
+  }
+  return c;
+}
+
+// Sleep for ns nanoseconds.
+// Returns 0, or -1 if the process was killed.
+int
+nsleep(uint64 ns)
+{
+  struct proc *p = myproc();
+  struct cpu *c;
+  int r;
+
+  c = timeradd(r_time() + ns / (1000000000L / TIMEBASE), &p->twake);
+  r = 0;
+  while(p->tcpu){
+    if(killed(p)){
+      timerremove(p, c);
+      r = -1;
+      break;
+    }
+    sleep(&p->twake, &c->tlock);
+  }
+  release(&c->tlock);
+  return r;
+}
+
+// Report timer interrupts for the statistics device.
+int
+statstimer(char *buf, int sz)
+{
+  struct cpu *c;
+  int n;
+
+  n = 0;
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if(c->ntimer == 0)
+      continue;
+    n += snprintf(buf+n, sz-n, "timer: cpu %d interrupts %d\n",
+                  (int)(c - cpus), c->ntimer);
+  }
+  return n;
+}
@@ -6,8 +6,7 @@
 #include "proc.h"
 #include "defs.h"
 
-struct spinlock tickslock;
-uint ticks;
+extern uint64 timer_scratch[NCPU][6];  // start.c
 
 extern char trampoline[], uservec[], userret[];
 
@@ -16,12 +15,6 @@ void kernelvec();
 
 extern int devintr();
 
-void
-trapinit(void)
-{
-  initlock(&tickslock, "time");
-}
-
 // set up to take exceptions and traps while in the kernel.
 void
 trapinithart(void)
@@ -65,6 +58,20 @@ usertrap(void)
     intr_on();
 
     syscall();
+  } else if(r_scause() == 12 || r_scause() == 13 || r_scause() == 15){
+    // page fault: a copy-on-write page, or one that hasn't
+    // been allocated or read in from the program yet.
+    uint64 va = r_stval();
+    int write = r_scause() == 15;
+
+    // reading the program file may sleep.
+    intr_on();
+
+    if(vmfault(p->pagetable, va, write) != 0){
+      printf("usertrap(): page fault %p pid=%d\n", va, p->pid);
+      printf("            sepc=%p\n", p->trapframe->epc);
+      setkilled(p);
+    }
   } else if((which_dev = devintr()) != 0){
     // ok
   } else {
@@ -78,7 +85,7 @@ usertrap(void)
 
   // give up the CPU if this is a timer interrupt.
   if(which_dev == 2)
-    yield();
+    proctick();
 
   usertrapret();
 }
@@ -152,7 +159,7 @@ kerneltrap()
 
   // give up the CPU if this is a timer interrupt.
   if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
-    yield();
+    proctick();
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -160,15 +167,6 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
-void
-clockintr()
-{
-  acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
-  release(&tickslock);
-}
-
 // check if it's an external interrupt or software interrupt,
 // and handle it.
 // returns 2 if timer interrupt,
@@ -203,17 +201,18 @@ devintr()
     return 1;
   } else if(scause == 0x8000000000000001L){
     // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // or from another CPU's kick(), forwarded by timervec
+    // in kernelvec.S.
 
-    if(cpuid() == 0){
-      clockintr();
-    }
-    
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
     w_sip(r_sip() & ~2);
 
-    return 2;
+    // a kick() only needs to wake this CPU up.
+    if(__atomic_exchange_n(&timer_scratch[cpuid()][5], 0, __ATOMIC_SEQ_CST) == 0)
+      return 1;
+
+    return timerintr();
   } else {
     return 0;
   }
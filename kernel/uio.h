@@ -0,0 +1,6 @@
+#define IOV_MAX 16  // most buffers for one readv() or writev()
+
+struct iovec {
+  void *iov_base;  // Start of buffer
+  uint64 iov_len;  // Size of buffer in bytes
+};
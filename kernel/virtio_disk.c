@@ -212,26 +212,18 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// fill in the three descriptors for b and put the chain on
+// the avail ring. the device isn't told until the caller
+// notifies it. caller holds vdisk_lock.
+static void
+queue_buf(struct buf *b, int write, int *idx)
 {
   uint64 sector = b->blockno * (BSIZE / 512);
 
-  acquire(&disk.vdisk_lock);
-
   // the spec's Section 5.2 says that legacy block operations use
   // three descriptors: one for type/reserved/sector, one for the
   // data, one for a 1-byte status result.
 
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
-  }
-
   // format the three descriptors.
   // qemu's virtio-blk.c reads them.
 
@@ -273,27 +265,81 @@ virtio_disk_rw(struct buf *b, int write)
 
   __sync_synchronize();
 
-  // tell the device another avail ring entry is available.
+  // another avail ring entry is available.
   disk.avail->idx += 1; // not % NUM ...
+}
 
+static void
+notify(void)
+{
   __sync_synchronize();
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+// start reading or writing each of the n bufs, without waiting
+// for them to finish. the device is notified once for the whole
+// batch, so it can work on all of them at the same time.
+// when a buf is done, virtio_disk_intr() clears b->disk, wakes
+// up virtio_disk_wait(), and calls b->done(b) if it is set.
+// the caller must hold each buf's sleeplock.
+void
+virtio_disk_startv(struct buf **bs, int n, int write)
+{
+  int idx[3];
+  int queued = 0;
+
+  acquire(&disk.vdisk_lock);
+
+  for(int i = 0; i < n; i++){
+    // allocate the three descriptors, letting the device see
+    // what we've queued so far if we have to wait for some.
+    while(alloc3_desc(idx) != 0){
+      if(queued){
+        notify();
+        queued = 0;
+      }
+      sleep(&disk.free[0], &disk.vdisk_lock);
+    }
+    queue_buf(bs[i], write, idx);
+    queued = 1;
   }
+  if(queued)
+    notify();
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+  release(&disk.vdisk_lock);
+}
 
+void
+virtio_disk_start(struct buf *b, int write)
+{
+  virtio_disk_startv(&b, 1, write);
+}
+
+// wait for the disk to finish with b.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
+  while(b->disk == 1) {
+    sleep(b, &disk.vdisk_lock);
+  }
   release(&disk.vdisk_lock);
 }
 
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_start(b, write);
+  virtio_disk_wait(b);
+}
+
 void
 virtio_disk_intr()
 {
+  struct buf *done[NUM];
+  int ndone = 0;
+
   acquire(&disk.vdisk_lock);
 
   // the device won't raise another interrupt until we tell it
@@ -317,6 +363,10 @@ virtio_disk_intr()
       panic("virtio_disk_intr status");
 
     struct buf *b = disk.info[id].b;
+    disk.info[id].b = 0;
+    free_chain(id);
+    if(b->done)
+      done[ndone++] = b;
     b->disk = 0;   // disk is done with buf
     wakeup(b);
 
@@ -324,4 +374,11 @@ virtio_disk_intr()
   }
 
   release(&disk.vdisk_lock);
+
+  // completion callbacks may take other spin locks. they run
+  // in interrupt context, so they must not sleep, and so
+  // must not start disk operations, since
+  // virtio_disk_startv() may sleep for free descriptors.
+  for(int i = 0; i < ndone; i++)
+    done[i]->done(done[i]);
 }
@@ -5,6 +5,8 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "proc.h"
 
 /*
  * the kernel's page table.
@@ -15,6 +17,14 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+// Page fault statistics.
+static struct {
+  int ncow;      // copy-on-write faults
+  int ncopy;     // pages copied for them
+  int nlazy;     // heap pages allocated on first touch
+  int ndemote;   // superpages broken into pages
+} vmstats;
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
@@ -30,6 +40,9 @@ kvmmake(void)
   // virtio mmio disk interface
   kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
+  // CLINT, for kick()
+  kvmmap(kpgtbl, CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
 
@@ -37,6 +50,8 @@ kvmmake(void)
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
   // map kernel data and the physical RAM we'll make use of.
+  // kvmmap() uses megapages for all but the first
+  // couple of megabytes.
   kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
 
   // map the trampoline for trap entry/exit to
@@ -70,6 +85,28 @@ kvminithart()
   sfence_vma();
 }
 
+// Replace the superpage leaf *pte at level with a page-table
+// page of leaves that map the same memory with the same
+// permissions. Each page already holds its own reference
+// (see ksuperalloc()), so nothing changes hands.
+// Returns the new page-table page, or 0 if out of memory.
+static pagetable_t
+demote(pte_t *pte, int level)
+{
+  pagetable_t pagetable;
+  uint64 pa, step;
+
+  if((pagetable = (pagetable_t)kalloc()) == 0)
+    return 0;
+  pa = PTE2PA(*pte);
+  step = 1L << PXSHIFT(level - 1);
+  for(int i = 0; i < 512; i++)
+    pagetable[i] = PA2PTE(pa + i*step) | PTE_FLAGS(*pte);
+  *pte = PA2PTE(pagetable) | PTE_V;
+  __sync_fetch_and_add(&vmstats.ndemote, 1);
+  return pagetable;
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
@@ -82,6 +119,10 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// A leaf PTE above level 0 maps a superpage; walk() breaks
+// one it meets into pages, and returns 0 if it can't allocate
+// the page-table page for that. walkleaf() doesn't.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
@@ -90,7 +131,10 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
 
   for(int level = 2; level > 0; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
-    if(*pte & PTE_V) {
+    if((*pte & PTE_V) && PTE_LEAF(*pte)) {
+      if((pagetable = demote(pte, level)) == 0)
+        return 0;
+    } else if(*pte & PTE_V) {
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
       if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
@@ -102,6 +146,35 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
   return &pagetable[PX(0, va)];
 }
 
+// Return the valid leaf PTE that maps va, of a page or a
+// superpage, or 0 if there is none. Sets *level to the level
+// of the PTE.
+static pte_t *
+walkleaf(pagetable_t pagetable, uint64 va, int *level)
+{
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    return 0;
+  for(*level = 2; *level >= 0; (*level)--) {
+    pte = &pagetable[PX(*level, va)];
+    if((*pte & PTE_V) == 0)
+      return 0;
+    if(PTE_LEAF(*pte) || *level == 0)
+      return pte;
+    pagetable = (pagetable_t)PTE2PA(*pte);
+  }
+  return 0;
+}
+
+// The physical address of the page holding va, which leaf
+// PTE pte at level maps.
+static uint64
+leafpa(pte_t pte, int level, uint64 va)
+{
+  return PTE2PA(pte) + (PGROUNDDOWN(va) & ((1L << PXSHIFT(level)) - 1));
+}
+
 // Look up a virtual address, return the physical address,
 // or 0 if not mapped.
 // Can only be used to look up user pages.
@@ -109,30 +182,71 @@ uint64
 walkaddr(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
-  uint64 pa;
-
-  if(va >= MAXVA)
-    return 0;
+  int level;
 
-  pte = walk(pagetable, va, 0);
+  pte = walkleaf(pagetable, va, &level);
   if(pte == 0)
     return 0;
-  if((*pte & PTE_V) == 0)
-    return 0;
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
-  return pa;
+  return leafpa(*pte, level, va);
 }
 
 // add a mapping to the kernel page table.
 // only used when booting.
 // does not flush TLB or enable paging.
+// Aligned, whole 2-megabyte stretches get megapages.
 void
 kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kpgtbl, va, sz, pa, perm) != 0)
-    panic("kvmmap");
+  uint64 n;
+
+  while(sz > 0){
+    if(va % SUPERPGSIZE == 0 && pa % SUPERPGSIZE == 0 && sz >= SUPERPGSIZE){
+      if(mapsuper(kpgtbl, va, pa, perm) != 0)
+        panic("kvmmap");
+      n = SUPERPGSIZE;
+    } else {
+      n = SUPERPGROUNDDOWN(va + SUPERPGSIZE) - va;
+      if(n > sz)
+        n = sz;
+      if(mappages(kpgtbl, va, n, pa, perm) != 0)
+        panic("kvmmap");
+    }
+    va += n;
+    pa += n;
+    sz -= n;
+  }
+}
+
+// Map the superpage at va, which must be aligned, to pa.
+// Returns 0 on success, or -1 if something is already
+// mapped in that superpage or walk() couldn't allocate a
+// needed page-table page.
+int
+mapsuper(pagetable_t pagetable, uint64 va, uint64 pa, int perm)
+{
+  pte_t *pte;
+
+  if(va % SUPERPGSIZE != 0 || pa % SUPERPGSIZE != 0 || va >= MAXVA)
+    panic("mapsuper");
+
+  pte = &pagetable[PX(2, va)];
+  if(*pte & PTE_V){
+    if(PTE_LEAF(*pte))
+      return -1;
+    pagetable = (pagetable_t)PTE2PA(*pte);
+  } else {
+    if((pagetable = (pde_t*)kalloc()) == 0)
+      return -1;
+    memset(pagetable, 0, PGSIZE);
+    *pte = PA2PTE(pagetable) | PTE_V;
+  }
+  pte = &pagetable[PX(1, va)];
+  if(*pte & PTE_V)
+    return -1;
+  *pte = PA2PTE(pa) | perm | PTE_V;
+  return 0;
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
@@ -165,22 +279,33 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 }
 
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that were never mapped, such as heap
+// pages no one has touched yet, are skipped. Superpages must
+// be removed whole.
 // Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
   uint64 a;
   pte_t *pte;
+  int level;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+    if((pte = walkleaf(pagetable, a, &level)) == 0)
+      continue;
+    if(level > 0){
+      if(level > 1 || a % SUPERPGSIZE != 0 ||
+         a + SUPERPGSIZE > va + npages*PGSIZE)
+        panic("uvmunmap: part of a superpage");
+      if(do_free)
+        ksuperfree((void*)PTE2PA(*pte));
+      *pte = 0;
+      a += SUPERPGSIZE - PGSIZE;
+      continue;
+    }
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -298,8 +423,9 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// The child shares the parent's physical pages. Writable
+// pages become read-only and copy-on-write in both page
+// tables; the first store to one makes a private copy.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
@@ -308,22 +434,19 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   pte_t *pte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
   for(i = 0; i < sz; i += PGSIZE){
     if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
+      continue;  // not touched yet
     if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+      continue;
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
-      goto err;
-    }
+    kdup((void*)pa);
   }
   return 0;
 
@@ -332,6 +455,162 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   return -1;
 }
 
+// Make copy-on-write page va writable, copying it unless
+// this page table holds the only reference to it.
+// Returns -1 if va isn't a copy-on-write page, or if out
+// of memory.
+int
+uvmcow(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  if((pte = walk(pagetable, va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U|PTE_COW))
+    return -1;
+  __sync_fetch_and_add(&vmstats.ncow, 1);
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+  if(krefs((void*)pa) == 1){
+    *pte = PA2PTE(pa) | flags;
+    return 0;
+  }
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, (char*)pa, PGSIZE);
+  *pte = PA2PTE(mem) | flags;
+  kfree((void*)pa);
+  __sync_fetch_and_add(&vmstats.ncopy, 1);
+  return 0;
+}
+
+// Share the pages mapped in [start, end) of old with new, for
+// fork() of an mmap() region. If cow is set, writable pages
+// become copy-on-write as in uvmcopy(); otherwise both page
+// tables map them writable. Superpages are shared whole,
+// except that copy-on-write works on pages.
+// returns 0 on success, -1 on failure, leaving any pages
+// already mapped in new for the caller to unmap.
+int
+uvmshare(pagetable_t old, pagetable_t new, uint64 start, uint64 end, int cow)
+{
+  pte_t *pte;
+  uint64 pa, i;
+  uint flags;
+  int level;
+
+  for(i = start; i < end; i += PGSIZE){
+    if((pte = walkleaf(old, i, &level)) == 0)
+      continue;
+    if(level == 1 && !(cow && (*pte & PTE_W))){
+      pa = PTE2PA(*pte);
+      if(mapsuper(new, i, pa, PTE_FLAGS(*pte) & ~PTE_V) != 0)
+        return -1;
+      ksuperdup((void*)pa);
+      i += SUPERPGSIZE - PGSIZE;
+      continue;
+    }
+    if((pte = walk(old, i, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
+    if(cow && (*pte & PTE_W))
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+    pa = PTE2PA(*pte);
+    flags = PTE_FLAGS(*pte);
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
+      return -1;
+    kdup((void*)pa);
+  }
+  return 0;
+}
+
+// Handle a fault at va in the current process, which is
+// using pagetable: a store to a copy-on-write page, or the first
+// touch of a page of the program, which exec() left to be read
+// in, of a heap page that sbrk() added without allocating, or
+// of an mmap() region.
+// Called from usertrap(), and by copyin() and copyout().
+// Returns 0 if the access can be retried, -1 if it is an error
+// or there is no memory.
+int
+vmfault(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  struct vmseg *s;
+  struct vma *v;
+  pte_t *pte;
+  char *mem;
+  int level;
+
+  if(va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+  pte = walkleaf(pagetable, va, &level);
+  if(pte){
+    if(write && (*pte & PTE_COW))
+      return uvmcow(pagetable, va);
+    if(write && (*pte & (PTE_U|PTE_W|PTE_D)) == (PTE_U|PTE_W)){
+      // Hardware that doesn't set the dirty bit itself
+      // faults on the first store instead.
+      *pte |= PTE_D;
+      return 0;
+    }
+    return -1;
+  }
+
+  if(pagetable != p->pagetable)
+    return -1;
+  if(va >= p->sz){
+    if((v = vmafind(p, va)) != 0)
+      return vmafault(p, v, va, write);
+    return -1;
+  }
+  if((s = execseg(p, va)) != 0)
+    return execfault(p, s, va);
+
+  // The rest of memory below p->sz is zero-filled.
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_R|PTE_W|PTE_U) != 0){
+    kfree(mem);
+    return -1;
+  }
+  __sync_fetch_and_add(&vmstats.nlazy, 1);
+  return 0;
+}
+
+// The kernel is about to copy to or from the user buffer at va
+// with locks held, which can't be done if a page of it has to
+// be read from the program or a mapped file. Read in any such
+// pages now. Heap and anonymous pages are left to the copy,
+// which can allocate them without sleeping, so that a big
+// buffer isn't committed for a read that returns a few bytes.
+void
+vmprefault(uint64 va, uint64 n)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 a;
+
+  if(va + n < va)
+    return;
+  for(a = PGROUNDDOWN(va); a < va + n && a < MAXVA; a += PGSIZE){
+    if(a < p->sz){
+      if(execseg(p, a) == 0)
+        continue;
+    } else if((v = vmafind(p, a)) == 0 || v->f == 0){
+      continue;
+    }
+    if(walkaddr(p->pagetable, a) == 0 && vmfault(p->pagetable, a, 0) != 0)
+      break;  // the copy will fail here
+  }
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
@@ -352,12 +631,23 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  pte_t *pte;
+  int level;
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(va0 >= MAXVA)
+      return -1;
+    pte = walkleaf(pagetable, va0, &level);
+    if(pte == 0 || (*pte & PTE_W) == 0){
+      if(vmfault(pagetable, va0, 1) != 0)
+        return -1;
+      pte = walkleaf(pagetable, va0, &level);
+    }
+    if(pte == 0 || (*pte & (PTE_V|PTE_U|PTE_W)) != (PTE_V|PTE_U|PTE_W))
       return -1;
+    *pte |= PTE_A|PTE_D;  // the store below bypasses this mapping
+    pa0 = leafpa(*pte, level, va0);
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
@@ -380,9 +670,11 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
+    if((pa0 = walkaddr(pagetable, va0)) == 0){
+      if(vmfault(pagetable, va0, 0) != 0)
+        return -1;
+      pa0 = walkaddr(pagetable, va0);
+    }
     n = PGSIZE - (srcva - va0);
     if(n > len)
       n = len;
@@ -407,9 +699,11 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
+    if((pa0 = walkaddr(pagetable, va0)) == 0){
+      if(vmfault(pagetable, va0, 0) != 0)
+        return -1;
+      pa0 = walkaddr(pagetable, va0);
+    }
     n = PGSIZE - (srcva - va0);
     if(n > max)
       n = max;
@@ -437,3 +731,11 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
     return -1;
   }
 }
+
+// Report page fault activity for the statistics device.
+int
+statsvm(char *buf, int sz)
+{
+  return snprintf(buf, sz, "vm: cow faults %d copied %d lazy faults %d demoted superpages %d\n",
+                  vmstats.ncow, vmstats.ncopy, vmstats.nlazy, vmstats.ndemote);
+}
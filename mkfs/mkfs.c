@@ -22,7 +22,7 @@
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog = LOGSIZE+1;  // header block, then LOGSIZE log slots
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -31,6 +31,8 @@ struct superblock sb;
 char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
+struct dirent rootde[NINODES];
+int nrootde;
 
 
 void balloc(int);
@@ -40,6 +42,7 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void dxwrite(uint inum, uint parent, struct dirent *de, int n);
 void die(const char *);
 
 // convert to riscv byte order
@@ -69,10 +72,9 @@ int
 main(int argc, char *argv[])
 {
   int i, cc, fd;
-  uint rootino, inum, off;
-  struct dirent de;
+  uint rootino, inum;
+  struct dirent *de;
   char buf[BSIZE];
-  struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
@@ -84,6 +86,8 @@ main(int argc, char *argv[])
 
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
+  assert(sizeof(struct extnode) <= BSIZE);
+  assert(sizeof(struct dxroot) == BSIZE);
 
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0)
@@ -117,16 +121,6 @@ main(int argc, char *argv[])
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
-
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
-
   for(i = 2; i < argc; i++){
     // get rid of "user/"
     char *shortname;
@@ -149,10 +143,10 @@ main(int argc, char *argv[])
 
     inum = ialloc(T_FILE);
 
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    assert(nrootde < NINODES);
+    de = &rootde[nrootde++];
+    de->inum = xshort(inum);
+    strncpy(de->name, shortname, DIRSIZ);
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -160,12 +154,7 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  dxwrite(rootino, rootino, rootde, nrootde);
 
   balloc(freeblock);
 
@@ -249,6 +238,78 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Look for block fbn among the n extents in ext.
+// Returns its disk block, or 0.
+uint
+extfind(struct extent *ext, uint n, uint fbn)
+{
+  uint i, lblk;
+
+  for(i = 0; i < n; i++){
+    lblk = xint(ext[i].lblk);
+    if(fbn >= lblk && fbn - lblk < xint(ext[i].len))
+      return xint(ext[i].start) + fbn - lblk;
+  }
+  return 0;
+}
+
+// Return the disk block holding block fbn of the file,
+// allocating it if fbn is just past the end. Extents past
+// the inode's own go in a single leaf block, which is
+// plenty for the files mkfs writes.
+uint
+bmapx(struct dinode *din, uint fbn)
+{
+  char buf[BSIZE];
+  struct extnode *leaf = (struct extnode*)buf;
+  struct extent *ext, *last;
+  uint n, max, x;
+
+  for(n = 0; n < NIEXTENT && xint(din->ext[n].len) != 0; n++)
+    ;
+  if((x = extfind(din->ext, n, fbn)) != 0)
+    return x;
+
+  ext = din->ext;
+  max = NIEXTENT;
+  if(xint(din->extroot) != 0){
+    rsect(xint(din->extroot), buf);
+    assert(xint(leaf->depth) == 0);
+    ext = leaf->ext;
+    n = xint(leaf->n);
+    max = NEXTPB;
+    if((x = extfind(ext, n, fbn)) != 0)
+      return x;
+  }
+
+  // allocate a new block at the end of the file.
+  x = freeblock++;
+  last = n > 0 ? &ext[n-1] : 0;
+  assert(fbn == (last ? xint(last->lblk) + xint(last->len) : 0));
+  if(last && xint(last->start) + xint(last->len) == x){
+    last->len = xint(xint(last->len) + 1);
+  } else if(n < max){
+    ext[n].lblk = xint(fbn);
+    ext[n].start = xint(x);
+    ext[n].len = xint(1);
+    if(ext == leaf->ext)
+      leaf->n = xint(n + 1);
+  } else {
+    assert(ext == din->ext);
+    bzero(buf, sizeof(buf));
+    leaf->depth = xint(0);
+    leaf->n = xint(1);
+    leaf->ext[0].lblk = xint(fbn);
+    leaf->ext[0].start = xint(x);
+    leaf->ext[0].len = xint(1);
+    din->extroot = xint(freeblock++);
+    ext = leaf->ext;
+  }
+  if(ext == leaf->ext)
+    wsect(xint(din->extroot), buf);
+  return x;
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -256,7 +317,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -265,22 +325,7 @@ iappend(uint inum, void *xp, int n)
   while(n > 0){
     fbn = off / BSIZE;
     assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
+    x = bmapx(&din, fbn);
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
     bcopy(p, buf + off - (fbn * BSIZE), n1);
@@ -293,6 +338,75 @@ iappend(uint inum, void *xp, int n)
   winode(inum, &din);
 }
 
+// Hash a directory entry name.
+// Must agree with dxhash() in kernel/fs.c.
+uint
+dxhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+int
+dxcmp(const void *a, const void *b)
+{
+  uint ha = dxhash(((struct dirent*)a)->name);
+  uint hb = dxhash(((struct dirent*)b)->name);
+
+  return ha < hb ? -1 : ha > hb;
+}
+
+// Write the n entries in de as the contents of directory inum,
+// in the kernel's indexed format (see struct dxroot). Leaves
+// are filled only half way, so the kernel can add names to
+// them before it has to split them.
+void
+dxwrite(uint inum, uint parent, struct dirent *de, int n)
+{
+  struct dxroot root;
+  static struct dirent leaf[NDXENT][DPB];
+  uint h;
+  int i, nleaf, k;
+
+  qsort(de, n, sizeof(*de), dxcmp);
+
+  bzero(&root, sizeof(root));
+  root.dot.inum = xshort(inum);
+  strcpy(root.dot.name, ".");
+  root.dotdot.inum = xshort(parent);
+  strcpy(root.dotdot.name, "..");
+  root.magic = xint(DXMAGIC);
+
+  // Start a new leaf once one is half full, but never
+  // between two names with the same hash.
+  bzero(leaf, sizeof(leaf));
+  nleaf = k = 0;
+  for(i = 0; i < n; i++){
+    h = dxhash(de[i].name);
+    if(nleaf == 0 || (k >= DPB/2 && h != dxhash(de[i-1].name))){
+      assert(nleaf < NDXENT);
+      root.slot[nleaf/2].hash[nleaf%2] = xint(nleaf == 0 ? 0 : h);
+      root.slot[nleaf/2].blk[nleaf%2] = xshort(nleaf + 1);
+      nleaf++;
+      k = 0;
+    }
+    assert(k < DPB);
+    leaf[nleaf-1][k++] = de[i];
+  }
+  root.nent = xshort(nleaf);
+
+  iappend(inum, &root, sizeof(root));
+  for(i = 0; i < nleaf; i++)
+    iappend(inum, leaf[i], sizeof(leaf[i]));
+}
+
 void
 die(const char *s)
 {
@@ -9,6 +9,17 @@ cat(int fd)
 {
   int n;
 
+  // between files and pipes, let the kernel move the data.
+  if((n = splice(fd, 1, 64*1024)) >= 0){
+    while(n > 0)
+      n = splice(fd, 1, 64*1024);
+    if(n < 0){
+      fprintf(2, "cat: splice error\n");
+      exit(1);
+    }
+    return;
+  }
+
   while((n = read(fd, buf, sizeof(buf))) > 0) {
     if (write(1, buf, n) != n) {
       fprintf(2, "cat: write error\n");
@@ -1,4 +1,6 @@
 struct stat;
+struct pollfd;
+struct iovec;
 
 // system calls
 int fork(void);
@@ -22,6 +24,16 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+void* mmap(void*, uint64, int, int, int, uint);
+int munmap(void*, uint64);
+int nice(int);
+int nanosleep(uint64);
+int splice(int, int, int);
+int poll(struct pollfd*, int, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -39,3 +51,6 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+
+// statistics.c
+int statistics(void*, int);
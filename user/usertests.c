@@ -4,6 +4,8 @@
 #include "user/user.h"
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
+#include "kernel/poll.h"
+#include "kernel/uio.h"
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
@@ -785,6 +787,256 @@ pipe1(char *s)
   }
 }
 
+// writes and reads much bigger than the pipe's buffer, and
+// not lined up with its pages.
+void
+pipe2(char *s)
+{
+  int fds[2], pid, xstatus;
+  int seq, i, n, total;
+  enum { N=12, SZ=7001, RSZ=3000 };
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  seq = 0;
+  if(pid == 0){
+    close(fds[0]);
+    for(n = 0; n < N; n++){
+      for(i = 0; i < SZ; i++)
+        buf[i] = seq++;
+      if(write(fds[1], buf, SZ) != SZ){
+        printf("%s: short write\n", s);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  total = 0;
+  while((n = read(fds[0], buf, RSZ)) > 0){
+    for(i = 0; i < n; i++){
+      if((buf[i] & 0xff) != (seq++ & 0xff)){
+        printf("%s: wrong data at %d\n", s, total + i);
+        exit(1);
+      }
+    }
+    total += n;
+  }
+  close(fds[0]);
+  wait(&xstatus);
+  if(total != N * SZ){
+    printf("%s: total %d\n", s, total);
+    exit(1);
+  }
+  exit(xstatus);
+}
+
+// splice() from a file into a pipe, and from the pipe back
+// into another file.
+void
+splicetest(char *s)
+{
+  int fd, fds[2], pid, xstatus, i, n, total;
+  enum { SZ=10000 };
+
+  unlink("splice1");
+  unlink("splice2");
+  fd = open("splice1", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++)
+    buf[i] = i;
+  if(write(fd, buf, SZ) != SZ){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    fd = open("splice1", O_RDONLY);
+    total = 0;
+    while((n = splice(fd, fds[1], 3000)) > 0)
+      total += n;
+    exit(n < 0 || total != SZ);
+  }
+  close(fds[1]);
+  fd = open("splice2", O_CREATE|O_RDWR);
+  total = 0;
+  while((n = splice(fds[0], fd, SZ)) > 0)
+    total += n;
+  close(fds[0]);
+  close(fd);
+  wait(&xstatus);
+  if(n < 0 || total != SZ || xstatus != 0){
+    printf("%s: spliced %d bytes\n", s, total);
+    exit(1);
+  }
+
+  fd = open("splice2", O_RDONLY);
+  memset(buf, 0, SZ);
+  if(read(fd, buf, SZ) != SZ){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < SZ; i++){
+    if(buf[i] != (char)i){
+      printf("%s: wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+  if(splice(0, fds[1], 1) >= 0){
+    printf("%s: spliced a closed fd\n", s);
+    exit(1);
+  }
+  unlink("splice1");
+  unlink("splice2");
+  exit(0);
+}
+
+// poll() a pair of pipes, one of which a child writes to.
+void
+polltest(char *s)
+{
+  int a[2], b[2], pid, xstatus;
+  struct pollfd fds[3];
+
+  if(pipe(a) != 0 || pipe(b) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  fds[0].fd = a[0];
+  fds[0].events = POLLIN;
+  fds[1].fd = b[0];
+  fds[1].events = POLLIN;
+  fds[2].fd = NOFILE - 1;
+  fds[2].events = POLLIN;
+  if(poll(fds, 2, 50) != 0 || fds[0].revents || fds[1].revents){
+    printf("%s: empty pipes were ready\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    nanosleep(20000000);
+    write(b[1], "x", 1);
+    exit(0);
+  }
+  if(poll(fds, 2, -1) != 1 || fds[0].revents || fds[1].revents != POLLIN){
+    printf("%s: wrong pipe ready\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+
+  close(a[1]);
+  if(poll(fds, 3, 0) != 3 || fds[0].revents != POLLHUP ||
+     fds[1].revents != POLLIN || fds[2].revents != POLLNVAL){
+    printf("%s: wrong events\n", s);
+    exit(1);
+  }
+  fds[0].fd = b[1];
+  fds[0].events = POLLOUT;
+  if(poll(fds, 1, 0) != 1 || fds[0].revents != POLLOUT){
+    printf("%s: pipe not writable\n", s);
+    exit(1);
+  }
+  close(a[0]);
+  close(b[0]);
+  close(b[1]);
+  exit(xstatus);
+}
+
+// writev() and readv() several buffers at once, and pread()
+// and pwrite() without moving the file offset.
+void
+iovtest(char *s)
+{
+  struct iovec iov[3];
+  char hdr[8], tail[8];
+  int fd, i;
+  enum { SZ=6000 };
+
+  unlink("iovfile");
+  fd = open("iovfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  memmove(hdr, "header!", 8);
+  for(i = 0; i < SZ; i++)
+    buf[i] = i;
+  iov[0].iov_base = hdr;
+  iov[0].iov_len = 8;
+  iov[1].iov_base = buf;
+  iov[1].iov_len = SZ;
+  iov[2].iov_base = "tail";
+  iov[2].iov_len = 5;
+  if(writev(fd, iov, 3) != 8 + SZ + 5){
+    printf("%s: writev failed\n", s);
+    exit(1);
+  }
+
+  if(pwrite(fd, "HEAD", 4, 0) != 4 || pread(fd, tail, 5, 8 + SZ) != 5 ||
+     strcmp(tail, "tail") != 0){
+    printf("%s: pread/pwrite failed\n", s);
+    exit(1);
+  }
+  // the offset is still at the end.
+  if(read(fd, tail, 1) != 0){
+    printf("%s: pwrite moved the offset\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("iovfile", O_RDONLY);
+  memset(buf, 0, SZ);
+  iov[2].iov_base = tail;
+  iov[2].iov_len = sizeof(tail);
+  if(readv(fd, iov, 3) != 8 + SZ + 5){
+    printf("%s: readv failed\n", s);
+    exit(1);
+  }
+  if(memcmp(hdr, "HEADer!", 8) != 0 || strcmp(tail, "tail") != 0){
+    printf("%s: readv read wrong data\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++){
+    if(buf[i] != (char)i){
+      printf("%s: wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+  if(pread(0, tail, 1, 0) >= 0){
+    printf("%s: pread of the console\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("iovfile");
+  exit(0);
+}
 
 // test if child is killed (status = -1)
 void
@@ -2556,6 +2808,178 @@ sbrk8000(char *s)
 
 
 
+// mmap() a file shared and private, and anonymous memory
+// shared with a child.
+void
+mmaptest(char *s)
+{
+  char *file = "mmaptest";
+  char *p, *q;
+  int fd, i, pid, xst;
+
+  unlink(file);
+  fd = open(file, O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < PGSIZE; i++)
+    buf[i] = 'a' + i % 26;
+  for(i = 0; i < 2; i++){
+    if(write(fd, buf, PGSIZE) != PGSIZE){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+
+  p = mmap(0, 2*PGSIZE + 100, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  q = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, PGSIZE);
+  if(p == (char*)-1 || q == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  if(p[PGSIZE + 1] != 'b' || q[1] != 'b' || p[2*PGSIZE] != 0){
+    printf("%s: wrong contents\n", s);
+    exit(1);
+  }
+  q[0] = 'Q';
+  p[PGSIZE] = 'P';
+  if(q[0] != 'Q'){
+    printf("%s: private store lost\n", s);
+    exit(1);
+  }
+  // unmap the middle page only; the rest stays mapped.
+  if(munmap(p + PGSIZE, PGSIZE) < 0 || munmap(q, PGSIZE) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  if(p[0] != 'a'){
+    printf("%s: wrong contents after munmap\n", s);
+    exit(1);
+  }
+  munmap(p, 3*PGSIZE);
+  close(fd);
+  fd = open(file, O_RDONLY);
+  if(fd < 0 || read(fd, buf, PGSIZE) != PGSIZE || read(fd, buf, 1) != 1 ||
+     buf[0] != 'P'){
+    printf("%s: shared store not written back\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink(file);
+
+  p = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if(p == (char*)-1){
+    printf("%s: anonymous mmap failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    p[10] = 'c';
+    exit(0);
+  }
+  wait(&xst);
+  if(xst != 0 || p[10] != 'c'){
+    printf("%s: child's store not shared\n", s);
+    exit(1);
+  }
+  exit(0);
+}
+
+// MAP_HUGE memory, shared with a child, and unmapped
+// a superpage at a time.
+void
+hugetest(char *s)
+{
+  char *p;
+  int i, pid, xst;
+
+  p = mmap(0, 2*SUPERPGSIZE, PROT_READ|PROT_WRITE,
+           MAP_SHARED|MAP_ANONYMOUS|MAP_HUGE, -1, 0);
+  if(p == (char*)-1 || (uint64)p % SUPERPGSIZE != 0){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 2*SUPERPGSIZE; i += PGSIZE)
+    p[i] = i / PGSIZE;
+  if(munmap(p + PGSIZE, PGSIZE) == 0){
+    printf("%s: unmapped part of a superpage\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < 2*SUPERPGSIZE; i += PGSIZE)
+      if(p[i] != (char)(i / PGSIZE))
+        exit(1);
+    p[SUPERPGSIZE + 1] = 'c';
+    exit(0);
+  }
+  wait(&xst);
+  if(xst != 0 || p[SUPERPGSIZE + 1] != 'c'){
+    printf("%s: child saw wrong contents\n", s);
+    exit(1);
+  }
+  if(munmap(p, SUPERPGSIZE) < 0 || p[SUPERPGSIZE + PGSIZE] != 1){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+
+  // too big once rounded up to a superpage.
+  p = mmap(0, TRAPFRAME - 1, PROT_READ,
+           MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGE, -1, 0);
+  if(p != (char*)-1){
+    printf("%s: mmap of %p bytes succeeded\n", s, (void*)(TRAPFRAME - 1));
+    exit(1);
+  }
+  exit(0);
+}
+
+// nanosleep() sleeps at least as long as asked, and a
+// kill() cuts it short.
+void
+nanosleeptest(char *s)
+{
+  int t0, pid, xst;
+
+  t0 = uptime();
+  if(nanosleep(150000000) < 0 || uptime() - t0 < 1){
+    printf("%s: nanosleep returned early\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < 20; i++){
+    if(nanosleep(1000000) < 0){
+      printf("%s: short nanosleep failed\n", s);
+      exit(1);
+    }
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    nanosleep(100000000000L);
+    exit(0);
+  }
+  nanosleep(10000000);
+  t0 = uptime();
+  kill(pid);
+  wait(&xst);
+  if(xst != -1 || uptime() - t0 > 10){
+    printf("%s: kill didn't end nanosleep\n", s);
+    exit(1);
+  }
+  exit(0);
+}
+
 // regression test. test whether exec() leaks memory if one of the
 // arguments is invalid. the test passes if the kernel doesn't panic.
 void
@@ -2594,6 +3018,10 @@ struct test {
   {dirtest, "dirtest"},
   {exectest, "exectest"},
   {pipe1, "pipe1"},
+  {pipe2, "pipe2"},
+  {splicetest, "splicetest"},
+  {polltest, "polltest"},
+  {iovtest, "iovtest"},
   {killstatus, "killstatus"},
   {preempt, "preempt"},
   {exitwait, "exitwait"},
@@ -2634,6 +3062,9 @@ struct test {
   {sbrkbugs, "sbrkbugs" },
   {sbrklast, "sbrklast"},
   {sbrk8000, "sbrk8000"},
+  {mmaptest, "mmaptest" },
+  {hugetest, "hugetest" },
+  {nanosleeptest, "nanosleeptest" },
   {badarg, "badarg" },
 
   { 0, 0},
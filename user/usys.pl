@@ -36,3 +36,13 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("mmap");
+entry("munmap");
+entry("nice");
+entry("nanosleep");
+entry("splice");
+entry("poll");
+entry("readv");
+entry("writev");
+entry("pread");
+entry("pwrite");
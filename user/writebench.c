@@ -0,0 +1,65 @@
+// Measure big sequential writes to a file, in MB/s, for
+// several sizes of write(). The smallest sizes take about as
+// many log transactions as writes; bigger ones show what
+// batching the transactions buys.
+//
+// usage: writebench [MB]
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define MAXWRITE (256*1024)
+
+char buf[MAXWRITE];
+int sizes[] = { 1024, 3*1024, 16*1024, 64*1024, MAXWRITE };
+
+// Write total bytes in writes of sz bytes; return the ticks taken.
+int
+bench(int sz, int total)
+{
+  int fd, n, t0, t1;
+
+  unlink("writebench.tmp");
+  if((fd = open("writebench.tmp", O_CREATE|O_WRONLY)) < 0){
+    fprintf(2, "writebench: cannot create writebench.tmp\n");
+    exit(1);
+  }
+  t0 = uptime();
+  for(n = 0; n < total; n += sz){
+    if(write(fd, buf, sz) != sz){
+      fprintf(2, "writebench: write failed; is the disk full?\n");
+      exit(1);
+    }
+  }
+  close(fd);
+  t1 = uptime();
+  unlink("writebench.tmp");
+  return t1 - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, mb, total, ticks, kbs;
+
+  mb = 2;
+  if(argc > 1 && (mb = atoi(argv[1])) <= 0){
+    fprintf(2, "usage: writebench [MB]\n");
+    exit(1);
+  }
+  total = mb * 1024 * 1024;
+  memset(buf, 'w', sizeof(buf));
+
+  for(i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++){
+    ticks = bench(sizes[i], total);
+    if(ticks == 0)
+      ticks = 1;
+    kbs = total / 1024 * TICKHZ / ticks;
+    printf("writebench: %d MB in %d KB writes: %d.%d%d MB/s\n",
+           mb, sizes[i] / 1024, kbs / 1024,
+           kbs % 1024 * 10 / 1024, kbs % 1024 * 100 / 1024 % 10);
+  }
+  exit(0);
+}